@@ -530,12 +530,21 @@ lilv_world_new(void);
 */
 #define LILV_OPTION_DYN_MANIFEST "http://drobilla.net/ns/lilv#dyn-manifest"
 
+/**
+   Enable/disable parallel bundle loading.
+   If true, lilv_world_load_all() reads the manifests of all bundles using
+   a pool of threads, one per CPU.  The result is identical to sequential
+   loading.  Disabled by default.
+*/
+#define LILV_OPTION_PARALLEL_LOAD "http://drobilla.net/ns/lilv#parallel-load"
+
 /**
    Set an option option for `world`.
 
    Currently recognized options:
    @ref LILV_OPTION_FILTER_LANG
    @ref LILV_OPTION_DYN_MANIFEST
+   @ref LILV_OPTION_PARALLEL_LOAD
 */
 LILV_API void
 lilv_world_set_option(LilvWorld*      world,
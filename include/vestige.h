@@ -145,6 +145,12 @@ struct RemoteVstPlugin;
 #define kVstTransportCycleActive (1 << 2)
 #define kVstTransportRecording (1 << 3)
 
+#define kVstProcessLevelUnknown 0
+#define kVstProcessLevelUser 1
+#define kVstProcessLevelRealtime 2
+#define kVstProcessLevelPrefetch 3
+#define kVstProcessLevelOffline 4
+
 #define kVstAutomationWriting (1 << 6)
 #define kVstAutomationReading (1 << 7)
 
@@ -19,6 +19,11 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include <pthread.h>
+#ifndef _WIN32
+#    include <unistd.h>
+#endif
+
 #include "lv2/lv2plug.in/ns/ext/presets/presets.h"
 
 #include "lilv_internal.h"
@@ -26,6 +31,11 @@
 static int
 lilv_world_drop_graph(LilvWorld* world, const SordNode* graph);
 
+static void
+lilv_world_add_bundle(LilvWorld*      world,
+                      const LilvNode* bundle_uri,
+                      const LilvNode* manifest);
+
 LILV_API LilvWorld*
 lilv_world_new(void)
 {
@@ -100,6 +110,7 @@ lilv_world_new(void)
 	world->n_read_files        = 0;
 	world->opt.filter_language = true;
 	world->opt.dyn_manifest    = true;
+	world->opt.parallel_load   = false;
 
 	return world;
 
@@ -179,6 +190,11 @@ lilv_world_set_option(LilvWorld*      world,
 			world->opt.filter_language = lilv_node_as_bool(value);
 			return;
 		}
+	} else if (!strcmp(option, LILV_OPTION_PARALLEL_LOAD)) {
+		if (lilv_node_is_bool(value)) {
+			world->opt.parallel_load = lilv_node_as_bool(value);
+			return;
+		}
 	}
 	LILV_WARNF("Unrecognized or invalid option `%s'\n", option);
 }
@@ -692,6 +708,19 @@ lilv_world_load_bundle(LilvWorld* world, const LilvNode* bundle_uri)
 		return;
 	}
 
+	lilv_world_add_bundle(world, bundle_uri, manifest);
+	lilv_node_free(manifest);
+}
+
+/** Discover plugins and specifications of a bundle, after its manifest
+    has been read into the model. */
+static void
+lilv_world_add_bundle(LilvWorld*      world,
+                      const LilvNode* bundle_uri,
+                      const LilvNode* manifest)
+{
+	SordNode* bundle_node = bundle_uri->node;
+
 	// ?plugin a lv2:Plugin
 	SordIter* plug_results = sord_search(world->model,
 	                                     NULL,
@@ -741,7 +770,6 @@ lilv_world_load_bundle(LilvWorld* world, const LilvNode* bundle_uri)
 			lilv_node_free(plugin_uri);
 			sord_iter_free(plug_results);
 			lilv_world_drop_graph(world, bundle_node);
-			lilv_node_free(manifest);
 			lilv_nodes_free(unload_uris);
 			return;
 		}
@@ -802,8 +830,6 @@ lilv_world_load_bundle(LilvWorld* world, const LilvNode* bundle_uri)
 		}
 		sord_iter_free(i);
 	}
-
-	lilv_node_free(manifest);
 }
 
 static int
@@ -886,10 +912,31 @@ lilv_world_unload_bundle(LilvWorld* world, const LilvNode* bundle_uri)
 	return lilv_world_drop_graph(world, bundle_uri->node);
 }
 
+/** A bundle whose manifest is read in parallel. */
+typedef struct {
+	LilvNode*  bundle;
+	LilvNode*  manifest;
+	char       prefix[32];
+	SordWorld* world;
+	SordModel* model;
+	SerdStatus status;
+} LilvBundleJob;
+
+/** Bundles to load, unless `parallel` is set, bundles are loaded immediately. */
+typedef struct {
+	LilvWorld*      world;
+	bool            parallel;
+	LilvBundleJob*  jobs;
+	unsigned        n_jobs;
+	unsigned        next;
+	pthread_mutex_t lock;
+} LilvBundleQueue;
+
 static void
 load_dir_entry(const char* dir, const char* name, void* data)
 {
-	LilvWorld* world = (LilvWorld*)data;
+	LilvBundleQueue* queue = (LilvBundleQueue*)data;
+	LilvWorld*       world = queue->world;
 	if (!strcmp(name, ".") || !strcmp(name, ".."))
 		return;
 
@@ -897,23 +944,194 @@ load_dir_entry(const char* dir, const char* name, void* data)
 	SerdNode  suri = serd_node_new_file_uri((const uint8_t*)path, 0, 0, true);
 	LilvNode* node = lilv_new_uri(world, (const char*)suri.buf);
 
-	lilv_world_load_bundle(world, node);
-	lilv_node_free(node);
+	if (!queue->parallel) {
+		lilv_world_load_bundle(world, node);
+		lilv_node_free(node);
+	} else if (!lilv_node_is_uri(node)) {
+		LILV_ERRORF("Bundle URI `%s' is not a URI\n",
+		            sord_node_get_string(node->node));
+		lilv_node_free(node);
+	} else {
+		queue->jobs = (LilvBundleJob*)realloc(
+			queue->jobs, (queue->n_jobs + 1) * sizeof(LilvBundleJob));
+		LilvBundleJob* job = &queue->jobs[queue->n_jobs++];
+		memset(job, 0, sizeof(LilvBundleJob));
+		job->bundle   = node;
+		job->manifest = lilv_world_get_manifest_uri(world, node);
+		// Blank node prefixes are assigned in bundle order
+		strcpy(job->prefix, (const char*)lilv_world_blank_node_prefix(world));
+	}
 	serd_node_free(&suri);
 	free(path);
 }
 
 /** Load all bundles in the directory at `dir_path`. */
 static void
-lilv_world_load_directory(LilvWorld* world, const char* dir_path)
+lilv_world_load_directory(LilvBundleQueue* queue, const char* dir_path)
 {
 	char* path = lilv_expand(dir_path);
 	if (path) {
-		lilv_dir_for_each(path, world, load_dir_entry);
+		lilv_dir_for_each(path, queue, load_dir_entry);
 		free(path);
 	}
 }
 
+/** Read a manifest into a private world and model (called from a worker). */
+static void
+lilv_bundle_job_parse(LilvBundleJob* job)
+{
+	const SerdNode* base = sord_node_to_serd_node(job->manifest->node);
+
+	job->world = sord_world_new();
+	job->model = sord_new(job->world, SORD_SPO, false);
+
+	SerdEnv*    env    = serd_env_new(base);
+	SerdReader* reader = sord_new_reader(job->model, env, SERD_TURTLE, NULL);
+
+	serd_reader_add_blank_prefix(reader, (const uint8_t*)job->prefix);
+	job->status = serd_reader_read_file(
+		reader, sord_node_get_string(job->manifest->node));
+
+	serd_reader_free(reader);
+	serd_env_free(env);
+}
+
+static void*
+lilv_bundle_worker(void* arg)
+{
+	LilvBundleQueue* queue = (LilvBundleQueue*)arg;
+	for (;;) {
+		pthread_mutex_lock(&queue->lock);
+		const unsigned i = queue->next++;
+		pthread_mutex_unlock(&queue->lock);
+		if (i >= queue->n_jobs) {
+			break;
+		}
+		lilv_bundle_job_parse(&queue->jobs[i]);
+	}
+	return NULL;
+}
+
+static unsigned
+lilv_n_cpus(void)
+{
+#ifdef _WIN32
+	SYSTEM_INFO si;
+	GetSystemInfo(&si);
+	return si.dwNumberOfProcessors;
+#elif defined(_SC_NPROCESSORS_ONLN)
+	const long n = sysconf(_SC_NPROCESSORS_ONLN);
+	return n > 0 ? (unsigned)n : 1;
+#else
+	return 1;
+#endif
+}
+
+/** Copy a node of a private world into the world. */
+static SordNode*
+lilv_world_import_node(LilvWorld* world, const SordNode* node)
+{
+	const uint8_t* str = sord_node_get_string(node);
+	switch (sord_node_get_type(node)) {
+	case SORD_URI:
+		return sord_new_uri(world->world, str);
+	case SORD_BLANK:
+		return sord_new_blank(world->world, str);
+	case SORD_LITERAL: {
+		const SordNode* dt    = sord_node_get_datatype(node);
+		SordNode*       wdt   = dt ? sord_new_uri(world->world, sord_node_get_string(dt)) : NULL;
+		SordNode*       wnode = sord_new_literal(
+			world->world, wdt, str, sord_node_get_language(node));
+		sord_node_free(world->world, wdt);
+		return wnode;
+	}
+	}
+	return NULL;
+}
+
+/** Add the statements of a parsed manifest to the world, with graph = bundle.
+    This is the equivalent of lilv_world_load_graph() for a finished job. */
+static SerdStatus
+lilv_world_merge_job(LilvWorld* world, LilvBundleJob* job)
+{
+	ZixTreeIter* iter;
+	if (!zix_tree_find((ZixTree*)world->loaded_files, job->manifest, &iter)) {
+		return SERD_FAILURE;  // File has already been loaded
+	}
+
+	SordIter* i = sord_begin(job->model);
+	for (; !sord_iter_end(i); sord_iter_next(i)) {
+		SordQuad tup;
+		sord_iter_get(i, tup);
+		SordNode* s = lilv_world_import_node(world, tup[SORD_SUBJECT]);
+		SordNode* p = lilv_world_import_node(world, tup[SORD_PREDICATE]);
+		SordNode* o = lilv_world_import_node(world, tup[SORD_OBJECT]);
+		SordQuad  quad = { s, p, o, job->bundle->node };
+		sord_add(world->model, quad);
+		sord_node_free(world->world, s);
+		sord_node_free(world->world, p);
+		sord_node_free(world->world, o);
+	}
+	sord_iter_free(i);
+
+	if (job->status) {
+		LILV_ERRORF("Error loading file `%s'\n",
+		            lilv_node_as_string(job->manifest));
+		return job->status;
+	}
+
+	zix_tree_insert((ZixTree*)world->loaded_files,
+	                lilv_node_duplicate(job->manifest),
+	                NULL);
+	return SERD_SUCCESS;
+}
+
+/** Parse all queued manifests in parallel, then add the bundles in order. */
+static void
+lilv_world_load_queue(LilvBundleQueue* queue)
+{
+	LilvWorld* world = queue->world;
+
+	unsigned n_threads = lilv_n_cpus();
+	if (n_threads > queue->n_jobs) {
+		n_threads = queue->n_jobs;
+	}
+
+	pthread_t* threads = (pthread_t*)calloc(n_threads, sizeof(pthread_t));
+	unsigned   n_started = 0;
+	for (unsigned t = 1; t < n_threads; ++t) {
+		if (pthread_create(&threads[n_started], NULL, lilv_bundle_worker, queue)) {
+			break;
+		}
+		++n_started;
+	}
+
+	// Help out, and parse everything if no thread could be started
+	lilv_bundle_worker(queue);
+
+	for (unsigned t = 0; t < n_started; ++t) {
+		pthread_join(threads[t], NULL);
+	}
+	free(threads);
+
+	for (unsigned j = 0; j < queue->n_jobs; ++j) {
+		LilvBundleJob* job = &queue->jobs[j];
+
+		const SerdStatus st = lilv_world_merge_job(world, job);
+		sord_free(job->model);
+		sord_world_free(job->world);
+
+		if (st > SERD_FAILURE) {
+			LILV_ERRORF("Error reading %s\n", lilv_node_as_string(job->manifest));
+		} else {
+			lilv_world_add_bundle(world, job->bundle, job->manifest);
+		}
+
+		lilv_node_free(job->manifest);
+		lilv_node_free(job->bundle);
+	}
+}
+
 static const char*
 first_path_sep(const char* path)
 {
@@ -931,8 +1149,8 @@ first_path_sep(const char* path)
  * parent directories of bundles, not a list of bundle directories).
  */
 static void
-lilv_world_load_path(LilvWorld*  world,
-                     const char* lv2_path)
+lilv_world_load_path(LilvBundleQueue* queue,
+                     const char*      lv2_path)
 {
 	while (lv2_path[0] != '\0') {
 		const char* const sep = first_path_sep(lv2_path);
@@ -941,11 +1159,11 @@ lilv_world_load_path(LilvWorld*  world,
 			char* const  dir     = (char*)malloc(dir_len + 1);
 			memcpy(dir, lv2_path, dir_len);
 			dir[dir_len] = '\0';
-			lilv_world_load_directory(world, dir);
+			lilv_world_load_directory(queue, dir);
 			free(dir);
 			lv2_path += dir_len + 1;
 		} else {
-			lilv_world_load_directory(world, lv2_path);
+			lilv_world_load_directory(queue, lv2_path);
 			lv2_path = "\0";
 		}
 	}
@@ -1013,7 +1231,17 @@ lilv_world_load_all(LilvWorld* world)
 		lv2_path = LILV_DEFAULT_LV2_PATH;
 
 	// Discover bundles and read all manifest files into model
-	lilv_world_load_path(world, lv2_path);
+	LilvBundleQueue queue;
+	memset(&queue, 0, sizeof(queue));
+	queue.world    = world;
+	queue.parallel = world->opt.parallel_load && lilv_n_cpus() > 1;
+	pthread_mutex_init(&queue.lock, NULL);
+
+	lilv_world_load_path(&queue, lv2_path);
+	lilv_world_load_queue(&queue);
+
+	pthread_mutex_destroy(&queue.lock);
+	free(queue.jobs);
 
 	LILV_FOREACH(plugins, p, world->plugins) {
 		const LilvPlugin* plugin = (const LilvPlugin*)lilv_collection_get(
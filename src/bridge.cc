@@ -0,0 +1,673 @@
+/*
+ *  Copyright (C) 2016 Robin Gareus <robin@gareus.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <fcntl.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "bridge.h"
+#include "loadlib.h"
+
+#ifndef BRIDGE_EXE
+# define BRIDGE_EXE "lv2vst-bridge"
+#endif
+
+#define BRIDGE_POLL_MS 10 // check if the helper is alive while waiting
+
+#ifndef BRIDGE_RT_TIMEOUT_MS
+# define BRIDGE_RT_TIMEOUT_MS 2000 // a helper that does not complete a cycle is killed
+#endif
+
+extern char** environ;
+
+LV2VstBridge::LV2VstBridge (audioMasterCallback audioMaster, RtkLv2Description* desc, char const* const* bundles)
+	: VstPlugin (audioMaster, 0)
+	, _desc (desc)
+	, _fd (-1)
+	, _shm (0)
+	, _shm_size (0)
+	, _params (0)
+	, _dirty (0)
+	, _audio (0)
+	, _pid (0)
+	, _dead (false)
+	, _events_in (0)
+	, _events_out (0)
+	, _list_in (0)
+	, _list_out (0)
+	, _sched_sent (false)
+	, _chunk (0)
+{
+	pthread_mutexattr_t attr;
+	pthread_mutexattr_init (&attr);
+	pthread_mutexattr_settype (&attr, PTHREAD_MUTEX_RECURSIVE);
+	pthread_mutex_init (&_ctrl_lock, &attr);
+	pthread_mutexattr_destroy (&attr);
+
+	_fd = memfd_create ("lv2vst-bridge", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	if (_fd < 0 || ftruncate (_fd, sizeof (BridgeShm))) {
+		fprintf (stderr, "LV2Host: cannot allocate shared memory for the bridge\n");
+		cleanup ();
+		throw -1;
+	}
+
+	_shm = (BridgeShm*) mmap (NULL, sizeof (BridgeShm), PROT_READ | PROT_WRITE, MAP_SHARED, _fd, 0);
+	if (_shm == MAP_FAILED) {
+		_shm = 0;
+		cleanup ();
+		throw -1;
+	}
+	_shm_size = sizeof (BridgeShm);
+	_shm->magic   = BRIDGE_MAGIC;
+	_shm->version = BRIDGE_VERSION;
+	_shm->size    = sizeof (BridgeShm);
+	_shm->ctrl.turn = BridgePluginSide;
+	_shm->rt.turn   = BridgePluginSide;
+
+	if (!spawn (bundles)) {
+		cleanup ();
+		throw -2;
+	}
+
+	/* the helper instantiates the plugin, and grows the segment */
+	if (!call (&_shm->ctrl, BridgeInstantiate) || _shm->ctrl.ret == 0) {
+		/* the helper terminates by itself */
+		fprintf (stderr, "LV2Host: bridged instantiation of '%s' failed\n", desc->dsp_uri);
+		cleanup ();
+		throw -3;
+	}
+
+	/* the helper runs plugin code: read its values once, and compute the
+	 * layout here rather than trusting BridgeShm::size. The segment must
+	 * not shrink below that afterwards. */
+	const int32_t n_inputs  = _shm->num_inputs;
+	const int32_t n_outputs = _shm->num_outputs;
+	const int32_t n_params  = _shm->num_params;
+	const bool    counts_ok = n_inputs >= 0 && n_outputs >= 0 && n_params >= 0 && n_inputs <= INT32_MAX - n_outputs;
+	const size_t  size      = counts_ok ? bridge_size (n_params, n_inputs + n_outputs) : 0;
+	struct stat st;
+	if (!counts_ok || fcntl (_fd, F_ADD_SEALS, F_SEAL_SHRINK) || fstat (_fd, &st) || (uint64_t)st.st_size < size) {
+		fprintf (stderr, "LV2Host: invalid shared memory layout for '%s'\n", desc->dsp_uri);
+		call (&_shm->ctrl, BridgeQuit);
+		cleanup ();
+		throw -3;
+	}
+
+	void* shm = mmap (NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, _fd, 0);
+	if (shm == MAP_FAILED) {
+		call (&_shm->ctrl, BridgeQuit);
+		cleanup ();
+		throw -1;
+	}
+	munmap (_shm, sizeof (BridgeShm));
+	_shm = (BridgeShm*) shm;
+	_shm_size = size;
+	_params = bridge_params (_shm);
+	_dirty  = bridge_dirty (_shm, n_params);
+	_audio  = bridge_audio (_shm, n_params, 0);
+
+	_events_in  = (BridgeEvents*) calloc (1, sizeof (BridgeEvents));
+	_events_out = (BridgeEvents*) calloc (1, sizeof (BridgeEvents));
+	_list_in    = bridge_alloc_events ();
+	_list_out   = bridge_alloc_events ();
+
+	_effect.numInputs    = n_inputs;
+	_effect.numOutputs   = n_outputs;
+	_effect.numParams    = n_params;
+	_effect.uniqueID     = _shm->unique_id;
+	_effect.version      = _shm->plugin_version;
+	_effect.initialDelay = _shm->initial_delay;
+	_effect.flags        = _shm->flags & ~effFlagsHasEditor; // no GUI
+	_n_params = _effect.numParams;
+}
+
+LV2VstBridge::~LV2VstBridge ()
+{
+	if (!dead ()) {
+		call (&_shm->rt, BridgeQuit);
+		ctrl_call (BridgeQuit);
+	}
+	cleanup ();
+	free_desc (_desc);
+}
+
+/* release resources, except the description: on error the caller frees it */
+void LV2VstBridge::cleanup ()
+{
+	reap ();
+	if (_shm) {
+		munmap (_shm, _shm_size);
+	}
+	if (_fd >= 0) {
+		::close (_fd);
+	}
+	free (_events_in);
+	free (_events_out);
+	free (_list_in);
+	free (_list_out);
+	free (_chunk);
+	pthread_mutex_destroy (&_ctrl_lock);
+}
+
+/* ****************************************************************************
+ * Helper process
+ */
+
+bool LV2VstBridge::spawn (char const* const* bundles)
+{
+	char exe[1024];
+	char fd[16];
+	char id[16];
+	snprintf (exe, sizeof (exe), "%s/%s", get_lib_path (), BRIDGE_EXE);
+	snprintf (fd, sizeof (fd), "%d", BRIDGE_SHM_FD);
+	snprintf (id, sizeof (id), "%08x", _desc->id);
+
+	uint32_t n_bundles = 0;
+	while (bundles && bundles[n_bundles]) {
+		++n_bundles;
+	}
+
+	char const** argv = (char const**) calloc (n_bundles + 4, sizeof (char*));
+	argv[0] = exe;
+	argv[1] = fd;
+	argv[2] = id;
+	for (uint32_t i = 0; i < n_bundles; ++i) {
+		argv[3 + i] = bundles[i];
+	}
+
+	/* the segment is passed as BRIDGE_SHM_FD, dup2 clears close-on-exec */
+	int src = _fd;
+	if (src == BRIDGE_SHM_FD) {
+		src = dup (_fd);
+	}
+
+	posix_spawn_file_actions_t fa;
+	posix_spawn_file_actions_init (&fa);
+	posix_spawn_file_actions_adddup2 (&fa, src, BRIDGE_SHM_FD);
+
+	int rv = posix_spawn (&_pid, exe, &fa, NULL, (char* const*)argv, environ);
+
+	posix_spawn_file_actions_destroy (&fa);
+	if (src != _fd) {
+		::close (src);
+	}
+	free (argv);
+
+	if (rv != 0) {
+		fprintf (stderr, "LV2Host: cannot execute '%s': %s\n", exe, strerror (rv));
+		_pid = 0;
+		return false;
+	}
+	return true;
+}
+
+void LV2VstBridge::reap ()
+{
+	const pid_t pid = __atomic_exchange_n (&_pid, 0, __ATOMIC_ACQ_REL);
+	if (pid <= 0) {
+		return;
+	}
+	int status;
+	for (int i = 0; i < 100; ++i) {
+		pid_t rv = waitpid (pid, &status, WNOHANG);
+		if (rv == pid || (rv < 0 && errno == ECHILD)) {
+			return;
+		}
+		usleep (10000);
+	}
+	fprintf (stderr, "LV2Host: bridge process does not terminate, killing it\n");
+	kill (pid, SIGKILL);
+	waitpid (pid, &status, 0);
+}
+
+/* called by the process and the ctrl thread: the pid is read once, and
+ * cleared by the thread which reaps the helper */
+bool LV2VstBridge::alive (void* arg)
+{
+	LV2VstBridge* self = (LV2VstBridge*) arg;
+	const pid_t pid = __atomic_load_n (&self->_pid, __ATOMIC_ACQUIRE);
+	if (pid <= 0) {
+		return false;
+	}
+	int status;
+	pid_t rv = waitpid (pid, &status, WNOHANG);
+	if (rv == pid) {
+		__atomic_store_n (&self->_pid, 0, __ATOMIC_RELEASE);
+		return false;
+	}
+	if (rv < 0 && errno == ECHILD) {
+		/* reaped by the other thread, or by the host */
+		return __atomic_load_n (&self->_pid, __ATOMIC_ACQUIRE) == pid && kill (pid, 0) == 0;
+	}
+	return true;
+}
+
+/* ****************************************************************************
+ * Requests
+ */
+
+bool LV2VstBridge::call (BridgeChannel* ch, int32_t op, int32_t index, intptr_t value, float opt)
+{
+	if (dead ()) {
+		return false;
+	}
+
+	ch->op    = op;
+	ch->index = index;
+	ch->value = value;
+	ch->opt   = opt;
+	bridge_pass (ch, BridgeHelperSide);
+
+	/* a helper that hangs must not block the host's process thread */
+	const int32_t timeout_ms = ch == &_shm->rt ? BRIDGE_RT_TIMEOUT_MS : 0;
+
+	while (true) {
+		if (!bridge_wait (ch, BridgePluginSide, BRIDGE_SPIN_US, BRIDGE_POLL_MS, timeout_ms, &alive, this)) {
+			if (alive (this)) {
+				fprintf (stderr, "LV2Host: bridge process for '%s' does not respond, killing it\n", _desc->dsp_uri);
+				const pid_t pid = __atomic_load_n (&_pid, __ATOMIC_ACQUIRE);
+				if (pid > 0) {
+					kill (pid, SIGKILL);
+				}
+			} else {
+				fprintf (stderr, "LV2Host: bridge process for '%s' terminated\n", _desc->dsp_uri);
+			}
+			__atomic_store_n (&_dead, true, __ATOMIC_RELEASE);
+			return false;
+		}
+		if (ch->op != BridgeCallback) {
+			return true;
+		}
+		host_callback (ch);
+	}
+}
+
+bool LV2VstBridge::ctrl_call (int32_t op, int32_t index, intptr_t value, float opt)
+{
+	pthread_mutex_lock (&_ctrl_lock);
+	bool rv = call (&_shm->ctrl, op, index, value, opt);
+	pthread_mutex_unlock (&_ctrl_lock);
+	return rv;
+}
+
+/* request a string, `len` excludes the terminating zero */
+void LV2VstBridge::ctrl_string (int32_t op, int32_t index, char* text, size_t len)
+{
+	BridgeChannel* ch = &_shm->ctrl;
+	*text = 0;
+	pthread_mutex_lock (&_ctrl_lock);
+	if (call (ch, op, index)) {
+		const size_t l = strnlen (ch->data, len);
+		memcpy (text, ch->data, l);
+		text[l] = 0;
+	}
+	pthread_mutex_unlock (&_ctrl_lock);
+}
+
+/* the helper calls the host */
+void LV2VstBridge::host_callback (BridgeChannel* ch)
+{
+	/* read once, the helper may modify the channel concurrently */
+	const int32_t opcode = ch->opcode;
+	const int32_t index  = ch->index;
+	void* ptr = 0;
+	bool forward = true;
+
+	switch (opcode) {
+		case audioMasterGetTime:
+			{
+				VstTimeInfo* ti = (VstTimeInfo*) audioMaster (&_effect, opcode, index, ch->value, 0, ch->opt);
+				if (ti) {
+					memcpy (ch->data, ti, sizeof (VstTimeInfo));
+				}
+				ch->ret = ti ? 1 : 0;
+			}
+			ch->op = BridgeReply;
+			bridge_pass (ch, BridgeHelperSide);
+			return;
+		case audioMasterIOChanged:
+			_effect.initialDelay = _shm->initial_delay;
+			break;
+		case audioMasterCanDo:
+			ch->data[BRIDGE_DATA_SIZE - 1] = 0;
+			ptr = ch->data;
+			break;
+		case audioMasterGetVendorString:
+		case audioMasterGetProductString:
+			ptr = ch->data;
+			break;
+		case audioMasterAutomate:
+		case audioMasterBeginEdit:
+		case audioMasterEndEdit:
+			forward = index >= 0 && index < _effect.numParams;
+			break;
+		case audioMasterVersion:
+		case audioMasterWantMidi:
+		case audioMasterGetSampleRate:
+		case audioMasterGetBlockSize:
+		case audioMasterGetCurrentProcessLevel:
+		case audioMasterGetVendorVersion:
+		case audioMasterUpdateDisplay:
+			break;
+		case audioMasterProcessEvents: // only during process, see BridgeShm::midi_out
+		case audioMasterSizeWindow:    // no GUI
+		default:                       // pointer arguments cannot be bridged
+			forward = false;
+			break;
+	}
+	ch->ret = forward ? audioMaster (&_effect, opcode, index, ch->value, ptr, ch->opt) : 0;
+	ch->op = BridgeReply;
+	bridge_pass (ch, BridgeHelperSide);
+}
+
+/* ****************************************************************************
+ * Processing
+ */
+
+int32_t LV2VstBridge::process_events (VstEvents* events)
+{
+	for (int32_t i = 0; i < events->numEvents; ++i) {
+		bridge_event_add (_events_in, events->events[i], 0);
+	}
+	return 1;
+}
+
+void LV2VstBridge::process (float** inputs, float** outputs, int32_t n_samples)
+{
+	BridgeShm* s = _shm;
+
+	if (dead ()) {
+		for (int32_t c = 0; c < _effect.numOutputs; ++c) {
+			memset (outputs[c], 0, n_samples * sizeof (float));
+		}
+		bridge_events_clear (_events_in);
+		return;
+	}
+
+	if (!_sched_sent) {
+		/* the helper's process thread uses the same priority */
+		struct sched_param sp;
+		int policy;
+		if (pthread_getschedparam (pthread_self (), &policy, &sp) == 0) {
+			s->sched_policy = policy;
+			s->sched_priority = sp.sched_priority;
+		}
+		_sched_sent = true;
+	}
+
+	/* query the host once per cycle, LV2Vst::process () uses the copy */
+	VstTimeInfo* ti = get_time_info (kVstPpqPosValid | kVstBarsValid | kVstTimeSigValid | kVstTempoValid);
+	if (ti) {
+		s->time_info = *ti;
+	}
+	s->has_time = ti ? 1 : 0;
+	s->process_level = get_process_level ();
+
+	VstEvents* events = bridge_events (_events_in, _list_in);
+
+	for (int32_t off = 0; off < n_samples; off += BRIDGE_MAX_BLOCK) {
+		const int32_t n = n_samples - off > BRIDGE_MAX_BLOCK ? BRIDGE_MAX_BLOCK : n_samples - off;
+		const bool last = off + n == n_samples;
+
+		bridge_events_clear (&s->midi_in);
+		for (int32_t i = 0; i < events->numEvents; ++i) {
+			const int32_t t = ((VstMidiEvent*)events->events[i])->deltaFrames;
+			if ((t >= off || off == 0) && (t < off + n || last)) {
+				bridge_event_add (&s->midi_in, events->events[i], -off);
+			}
+		}
+		bridge_events_clear (&s->midi_out);
+
+		for (int32_t c = 0; c < _effect.numInputs; ++c) {
+			memcpy (&_audio[(size_t)c * BRIDGE_MAX_BLOCK], &inputs[c][off], n * sizeof (float));
+		}
+
+		s->n_samples = n;
+		if (!call (&s->rt, BridgeProcess)) {
+			for (int32_t c = 0; c < _effect.numOutputs; ++c) {
+				memset (&outputs[c][off], 0, (n_samples - off) * sizeof (float));
+			}
+			break;
+		}
+
+		for (int32_t c = 0; c < _effect.numOutputs; ++c) {
+			memcpy (&outputs[c][off], &_audio[(size_t)(_effect.numInputs + c) * BRIDGE_MAX_BLOCK], n * sizeof (float));
+		}
+
+		bridge_events_import (_events_out, &s->midi_out, n);
+		if (_events_out->n_events > 0) {
+			VstEvents* out = bridge_events (_events_out, _list_out);
+			for (int32_t i = 0; i < out->numEvents; ++i) {
+				((VstMidiEvent*)out->events[i])->deltaFrames += off;
+			}
+			send_events_to_host (out);
+		}
+	}
+
+	bridge_events_clear (_events_in);
+}
+
+/* ****************************************************************************
+ * Parameters
+ */
+
+float LV2VstBridge::get_parameter (int32_t index)
+{
+	if (index < 0 || index >= _effect.numParams) {
+		return 0;
+	}
+	return bridge_param_get (_params, index);
+}
+
+bool LV2VstBridge::set_parameter (int32_t index, float value)
+{
+	if (index < 0 || index >= _effect.numParams) {
+		return false;
+	}
+	/* applied by the helper at the start of the next cycle */
+	bridge_param_set (_params, _dirty, index, value);
+	return true;
+}
+
+/* LV2Vst limits strings depending on the host, see param_name_len () */
+void LV2VstBridge::get_parameter_label (int32_t index, char* label)
+{
+	ctrl_string (BridgeGetParameterLabel, index, label, 256);
+}
+
+void LV2VstBridge::get_parameter_display (int32_t index, char* text)
+{
+	ctrl_string (BridgeGetParameterDisplay, index, text, 8);
+}
+
+void LV2VstBridge::get_parameter_name (int32_t index, char* text)
+{
+	ctrl_string (BridgeGetParameterName, index, text, 256);
+}
+
+bool LV2VstBridge::get_parameter_properties (int32_t index, VstParameterProperties* p)
+{
+	BridgeChannel* ch = &_shm->ctrl;
+	bool rv = false;
+	pthread_mutex_lock (&_ctrl_lock);
+	if (call (ch, BridgeGetParameterProperties, index) && ch->ret) {
+		memcpy (p, ch->data, sizeof (VstParameterProperties));
+		rv = true;
+	}
+	pthread_mutex_unlock (&_ctrl_lock);
+	return rv;
+}
+
+bool LV2VstBridge::can_be_automated (int32_t index)
+{
+	pthread_mutex_lock (&_ctrl_lock);
+	bool rv = call (&_shm->ctrl, BridgeCanBeAutomated, index) && _shm->ctrl.ret;
+	pthread_mutex_unlock (&_ctrl_lock);
+	return rv;
+}
+
+/* ****************************************************************************
+ * Info
+ */
+
+bool LV2VstBridge::get_effect_name (char* name)
+{
+	ctrl_string (BridgeGetEffectName, 0, name, 32);
+	return true;
+}
+
+bool LV2VstBridge::get_vendor_string (char* text)
+{
+	ctrl_string (BridgeGetVendorString, 0, text, 64);
+	return true;
+}
+
+bool LV2VstBridge::get_product_string (char* text)
+{
+	ctrl_string (BridgeGetProductString, 0, text, 64);
+	return true;
+}
+
+int32_t LV2VstBridge::get_vendor_version ()
+{
+	pthread_mutex_lock (&_ctrl_lock);
+	int32_t rv = call (&_shm->ctrl, BridgeGetVendorVersion) ? _shm->ctrl.ret : 0;
+	pthread_mutex_unlock (&_ctrl_lock);
+	return rv;
+}
+
+VstPlugCategory LV2VstBridge::get_category ()
+{
+	pthread_mutex_lock (&_ctrl_lock);
+	int32_t rv = call (&_shm->ctrl, BridgeGetCategory) ? _shm->ctrl.ret : kPlugCategUnknown;
+	pthread_mutex_unlock (&_ctrl_lock);
+	return (VstPlugCategory) rv;
+}
+
+int32_t LV2VstBridge::can_do (char* text)
+{
+	BridgeChannel* ch = &_shm->ctrl;
+	int32_t rv = 0;
+	pthread_mutex_lock (&_ctrl_lock);
+	strncpy (ch->data, text, BRIDGE_DATA_SIZE - 1);
+	ch->data[BRIDGE_DATA_SIZE - 1] = 0;
+	if (call (ch, BridgeCanDo)) {
+		rv = ch->ret;
+	}
+	pthread_mutex_unlock (&_ctrl_lock);
+	return rv;
+}
+
+int32_t LV2VstBridge::bypass_plugin (bool bypass)
+{
+	pthread_mutex_lock (&_ctrl_lock);
+	int32_t rv = call (&_shm->ctrl, BridgeBypass, 0, bypass ? 1 : 0) ? _shm->ctrl.ret : 0;
+	pthread_mutex_unlock (&_ctrl_lock);
+	return rv;
+}
+
+/* ****************************************************************************
+ * Configuration
+ */
+
+void LV2VstBridge::set_sample_rate (float sr)
+{
+	VstPlugin::set_sample_rate (sr);
+	ctrl_call (BridgeSetSampleRate, 0, 0, sr);
+}
+
+void LV2VstBridge::set_block_size (int32_t bs)
+{
+	VstPlugin::set_block_size (bs);
+	ctrl_call (BridgeSetBlockSize, 0, bs);
+}
+
+void LV2VstBridge::resume ()
+{
+	ctrl_call (BridgeResume);
+	_effect.initialDelay = _shm->initial_delay;
+}
+
+void LV2VstBridge::suspend ()
+{
+	ctrl_call (BridgeSuspend);
+}
+
+/* ****************************************************************************
+ * State, transferred in pieces of BRIDGE_DATA_SIZE
+ */
+
+int32_t LV2VstBridge::get_chunk (void** data, bool is_preset)
+{
+	BridgeChannel* ch = &_shm->ctrl;
+	int32_t size = 0;
+
+	pthread_mutex_lock (&_ctrl_lock);
+	if (call (ch, BridgeGetChunk, 0, is_preset ? 1 : 0) && ch->ret > 0 && ch->ret <= INT32_MAX) {
+		size = ch->ret;
+	}
+	free (_chunk);
+	_chunk = size > 0 ? (uint8_t*) malloc (size) : 0;
+	if (!_chunk) {
+		size = 0;
+	}
+
+	for (int32_t off = 0; off < size;) {
+		/* the size of each piece is checked against the request */
+		const int64_t n = call (ch, BridgeGetChunkData, off) ? ch->ret : 0;
+		if (n <= 0 || n > BRIDGE_DATA_SIZE || n > size - off) {
+			size = 0;
+			break;
+		}
+		memcpy (&_chunk[off], ch->data, n);
+		off += n;
+	}
+	pthread_mutex_unlock (&_ctrl_lock);
+
+	*data = _chunk;
+	return size;
+}
+
+int32_t LV2VstBridge::set_chunk (void* data, int32_t size, bool is_preset)
+{
+	BridgeChannel* ch = &_shm->ctrl;
+	const uint8_t* d = (const uint8_t*) data;
+	int32_t rv = 0;
+
+	pthread_mutex_lock (&_ctrl_lock);
+	int32_t off = 0;
+	while (off < size) {
+		const int32_t n = size - off > BRIDGE_DATA_SIZE ? BRIDGE_DATA_SIZE : size - off;
+		memcpy (ch->data, &d[off], n);
+		if (!call (ch, BridgeSetChunkData, off, n)) {
+			break;
+		}
+		off += n;
+	}
+	if (off == size && call (ch, BridgeSetChunk, is_preset ? 1 : 0, size)) {
+		rv = ch->ret;
+	}
+	pthread_mutex_unlock (&_ctrl_lock);
+	return rv;
+}
@@ -0,0 +1,442 @@
+/*
+ *  Copyright (C) 2016 Robin Gareus <robin@gareus.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef _lv2vst_bridge_h_
+#define _lv2vst_bridge_h_
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <linux/futex.h>
+
+#include "vst.h"
+#include "lv2ttl.h"
+
+/* Out-of-process bridge: the LV2Vst instance lives in a helper process
+ * (lv2vst-bridge), all communication uses a shared memory segment.
+ *
+ * There are two channels, one for the realtime thread (process) and one
+ * for everything else. A channel is owned by either side at a time
+ * (`turn`), ownership is passed with an atomic store and a futex wake-up.
+ * The waiting side spins briefly before sleeping on the futex, so short
+ * requests complete without a syscall on the return path.
+ *
+ * While the plugin waits for a reply, the helper may call back into the
+ * host (BridgeCallback), and the plugin may issue nested requests while
+ * handling such a callback. Both sides process messages in stack order.
+ */
+
+#ifndef BRIDGE_SPIN_US
+# define BRIDGE_SPIN_US 50 // busy-wait before sleeping on the futex
+#endif
+
+#define BRIDGE_MAGIC      0x4c325642 // "L2VB"
+#define BRIDGE_VERSION    1
+#define BRIDGE_MAX_BLOCK  8192   // larger host cycles are split
+#define BRIDGE_MAX_EVENTS 512    // MIDI events per direction and cycle
+#define BRIDGE_SYSEX_SIZE 16384  // sysex payload per direction and cycle
+#define BRIDGE_DATA_SIZE  65536  // strings, properties, chunks (in pieces)
+#define BRIDGE_SHM_FD     3      // file-descriptor of the segment in the helper
+
+enum BridgeSide {
+	BridgePluginSide = 0,
+	BridgeHelperSide = 1,
+};
+
+enum BridgeOp {
+	/* plugin -> helper */
+	BridgeInstantiate = 1,
+	BridgeQuit,
+	BridgeProcess,
+	BridgeSetSampleRate,
+	BridgeSetBlockSize,
+	BridgeResume,
+	BridgeSuspend,
+	BridgeGetParameterLabel,
+	BridgeGetParameterDisplay,
+	BridgeGetParameterName,
+	BridgeGetParameterProperties,
+	BridgeCanBeAutomated,
+	BridgeGetEffectName,
+	BridgeGetVendorString,
+	BridgeGetProductString,
+	BridgeGetVendorVersion,
+	BridgeGetCategory,
+	BridgeCanDo,
+	BridgeBypass,
+	BridgeGetChunk,       ///< value: is_preset, returns the size
+	BridgeGetChunkData,   ///< index: offset, returns the number of bytes in data
+	BridgeSetChunkData,   ///< index: offset, value: number of bytes in data
+	BridgeSetChunk,       ///< value: size, index: is_preset
+	/* helper -> plugin */
+	BridgeReply,
+	BridgeCallback,       ///< audioMaster (opcode, index, value, data, opt)
+};
+
+struct BridgeChannel {
+	int32_t turn;         ///< futex, BridgeSide that owns the channel
+	int32_t sleeping[2];  ///< side is waiting on the futex
+	int32_t op;
+	int32_t opcode;
+	int32_t index;
+	int64_t value;
+	float   opt;
+	int64_t ret;
+	char    data[BRIDGE_DATA_SIZE];
+} __attribute__ ((aligned (64)));
+
+union BridgeEvent {
+	VstMidiEvent      midi;
+	VstMidiSysExEvent sysex; ///< sysexDump is an offset into BridgeEvents::sysex
+};
+
+struct BridgeEvents {
+	uint32_t    n_events;
+	uint32_t    sysex_used;
+	BridgeEvent events[BRIDGE_MAX_EVENTS];
+	char        sysex[BRIDGE_SYSEX_SIZE];
+};
+
+/* followed by parameter values, dirty-bits and audio buffers, see below */
+struct BridgeShm {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t size;           ///< total size, set by the helper
+
+	/* set by the helper after instantiation */
+	int32_t num_inputs;
+	int32_t num_outputs;
+	int32_t num_params;
+	int32_t flags;
+	int32_t unique_id;
+	int32_t plugin_version;
+	int32_t initial_delay;
+
+	/* set by the plugin, per process cycle */
+	int32_t n_samples;
+	int32_t process_level;
+	int32_t has_time;
+	int32_t sched_policy;
+	int32_t sched_priority;
+	VstTimeInfo time_info;
+
+	BridgeEvents midi_in;
+	BridgeEvents midi_out;
+
+	BridgeChannel ctrl;
+	BridgeChannel rt;
+};
+
+/* ****************************************************************************
+ * segment layout
+ */
+
+static inline size_t bridge_align (size_t s)
+{
+	return (s + 63) & ~(size_t)63;
+}
+
+/* the counts are passed explicitly: the plugin side must not re-read
+ * values from the segment that the helper can modify */
+static inline size_t bridge_dirty_offset (int32_t n_params)
+{
+	return bridge_align (sizeof (BridgeShm)) + bridge_align ((size_t)n_params * sizeof (float));
+}
+
+static inline size_t bridge_audio_offset (int32_t n_params)
+{
+	return bridge_dirty_offset (n_params) + bridge_align (((size_t)n_params + 31) / 32 * sizeof (uint32_t));
+}
+
+static inline size_t bridge_size (int32_t n_params, int32_t n_channels)
+{
+	return bridge_audio_offset (n_params) + (size_t)n_channels * BRIDGE_MAX_BLOCK * sizeof (float);
+}
+
+static inline float* bridge_params (BridgeShm* s)
+{
+	return (float*)((char*)s + bridge_align (sizeof (BridgeShm)));
+}
+
+static inline uint32_t* bridge_dirty (BridgeShm* s, int32_t n_params)
+{
+	return (uint32_t*)((char*)s + bridge_dirty_offset (n_params));
+}
+
+/* inputs first, then outputs */
+static inline float* bridge_audio (BridgeShm* s, int32_t n_params, int32_t c)
+{
+	return (float*)((char*)s + bridge_audio_offset (n_params)) + (size_t)c * BRIDGE_MAX_BLOCK;
+}
+
+/* ****************************************************************************
+ * parameters: latest value and a dirty-bit, see Lv2VstUtil::DirtyValues
+ */
+
+static inline void bridge_param_set (float* params, uint32_t* dirty, uint32_t p, float v)
+{
+	uint32_t b;
+	memcpy (&b, &v, sizeof (float));
+	__atomic_store_n ((uint32_t*)&params[p], b, __ATOMIC_RELAXED);
+	__atomic_fetch_or (&dirty[p >> 5], 1U << (p & 31), __ATOMIC_RELEASE);
+}
+
+static inline float bridge_param_get (float* params, uint32_t p)
+{
+	uint32_t b = __atomic_load_n ((uint32_t*)&params[p], __ATOMIC_RELAXED);
+	float v;
+	memcpy (&v, &b, sizeof (float));
+	return v;
+}
+
+/* ****************************************************************************
+ * MIDI events
+ */
+
+static inline void bridge_events_clear (BridgeEvents* q)
+{
+	q->n_events = 0;
+	q->sysex_used = 0;
+}
+
+/* copy an event to the queue, shifting its time by `delta` */
+static inline bool bridge_event_add (BridgeEvents* q, VstEvent const* ev, int32_t delta)
+{
+	if (q->n_events >= BRIDGE_MAX_EVENTS) {
+		return false;
+	}
+	VstMidiEvent const* mev = (VstMidiEvent const*) ev;
+	BridgeEvent* e = &q->events[q->n_events];
+
+	if (mev->type == kVstSysExType) {
+		VstMidiSysExEvent const* sev = (VstMidiSysExEvent const*) ev;
+		if (sev->dumpBytes <= 0 || !sev->sysexDump || q->sysex_used + sev->dumpBytes > BRIDGE_SYSEX_SIZE) {
+			return false;
+		}
+		e->sysex = *sev;
+		e->sysex.deltaFrames += delta;
+		e->sysex.sysexDump = (char*)(intptr_t)q->sysex_used;
+		memcpy (&q->sysex[q->sysex_used], sev->sysexDump, sev->dumpBytes);
+		q->sysex_used += sev->dumpBytes;
+	} else if (mev->type == kVstMidiType) {
+		e->midi = *mev;
+		e->midi.deltaFrames += delta;
+	} else {
+		return false;
+	}
+	++q->n_events;
+	return true;
+}
+
+/* point `list` (BRIDGE_MAX_EVENTS slots) to the events of the queue.
+ * sysex offsets are resolved in place, this must be called only once
+ * after the queue was filled. */
+static inline VstEvents* bridge_events (BridgeEvents* q, VstEvents* list)
+{
+	for (uint32_t i = 0; i < q->n_events; ++i) {
+		BridgeEvent* e = &q->events[i];
+		if (e->midi.type == kVstSysExType) {
+			e->sysex.sysexDump = &q->sysex[(intptr_t)e->sysex.sysexDump];
+		}
+		list->events[i] = (VstEvent*) e;
+	}
+	list->numEvents = q->n_events;
+	return list;
+}
+
+/* copy a queue that the other process wrote to `dst`: the event count
+ * is clamped, events with an unknown type or a sysex payload outside the
+ * pool are dropped and event times are limited to the cycle. */
+static inline void bridge_events_import (BridgeEvents* dst, BridgeEvents const* src, int32_t n_samples)
+{
+	bridge_events_clear (dst);
+	uint32_t n = src->n_events;
+	if (n > BRIDGE_MAX_EVENTS) {
+		n = BRIDGE_MAX_EVENTS;
+	}
+	for (uint32_t i = 0; i < n; ++i) {
+		BridgeEvent e;
+		memcpy (&e, &src->events[i], sizeof (BridgeEvent));
+		if (e.midi.deltaFrames < 0 || e.midi.deltaFrames >= n_samples) {
+			e.midi.deltaFrames = e.midi.deltaFrames < 0 ? 0 : n_samples - 1;
+		}
+		if (e.midi.type == kVstSysExType) {
+			const uintptr_t off = (uintptr_t)e.sysex.sysexDump;
+			if (e.sysex.dumpBytes <= 0 || off > BRIDGE_SYSEX_SIZE || (uintptr_t)e.sysex.dumpBytes > BRIDGE_SYSEX_SIZE - off) {
+				continue;
+			}
+			e.sysex.sysexDump = (char*)&src->sysex[off];
+			e.sysex.byteSize = sizeof (VstMidiSysExEvent);
+		} else {
+			e.midi.byteSize = sizeof (VstMidiEvent);
+		}
+		bridge_event_add (dst, (VstEvent*)&e, 0);
+	}
+}
+
+static inline VstEvents* bridge_alloc_events ()
+{
+	return (VstEvents*) calloc (1, sizeof (VstEvents) + (BRIDGE_MAX_EVENTS - 2) * sizeof (VstEvent*));
+}
+
+/* ****************************************************************************
+ * channel hand-over
+ */
+
+static inline void bridge_pass (BridgeChannel* ch, int32_t to)
+{
+	__atomic_store_n (&ch->turn, to, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n (&ch->sleeping[to], __ATOMIC_SEQ_CST)) {
+		syscall (SYS_futex, &ch->turn, FUTEX_WAKE, 1, NULL, NULL, 0);
+	}
+}
+
+static inline int64_t bridge_elapsed_us (struct timespec const* t0)
+{
+	struct timespec t1;
+	clock_gettime (CLOCK_MONOTONIC, &t1);
+	return (t1.tv_sec - t0->tv_sec) * 1000000 + (t1.tv_nsec - t0->tv_nsec) / 1000;
+}
+
+/* wait until the channel is passed to `me`: spin for `spin_us`, then
+ * sleep on the futex. `alive` is polled every `poll_ms` while sleeping,
+ * returns false if the other side is gone or if it does not pass the
+ * channel back within `timeout_ms` (0: no limit). */
+static inline bool bridge_wait (BridgeChannel* ch, int32_t me, int32_t spin_us, int32_t poll_ms, int32_t timeout_ms, bool (*alive)(void*), void* arg)
+{
+	struct timespec t0;
+	clock_gettime (CLOCK_MONOTONIC, &t0);
+
+	if (spin_us > 0) {
+		for (uint32_t i = 1;; ++i) {
+			if (__atomic_load_n (&ch->turn, __ATOMIC_ACQUIRE) == me) {
+				return true;
+			}
+#if defined __i386__ || defined __x86_64__
+			__builtin_ia32_pause ();
+#endif
+			if ((i & 63) == 0 && bridge_elapsed_us (&t0) > spin_us) {
+				break;
+			}
+		}
+	}
+
+	const struct timespec timeout = { poll_ms / 1000, (poll_ms % 1000) * 1000000 };
+	while (true) {
+		__atomic_store_n (&ch->sleeping[me], 1, __ATOMIC_SEQ_CST);
+		const int32_t turn = __atomic_load_n (&ch->turn, __ATOMIC_SEQ_CST);
+		long rv = 0;
+		if (turn != me) {
+			rv = syscall (SYS_futex, &ch->turn, FUTEX_WAIT, turn, &timeout, NULL, 0);
+		}
+		__atomic_store_n (&ch->sleeping[me], 0, __ATOMIC_RELAXED);
+		if (__atomic_load_n (&ch->turn, __ATOMIC_ACQUIRE) == me) {
+			return true;
+		}
+		if (rv != 0 && errno == ETIMEDOUT && !alive (arg)) {
+			return false;
+		}
+		if (timeout_ms > 0 && bridge_elapsed_us (&t0) > (int64_t)timeout_ms * 1000) {
+			return false;
+		}
+	}
+}
+
+/* ****************************************************************************
+ * plugin side
+ */
+
+class LV2VstBridge : public VstPlugin
+{
+	public:
+		/* takes ownership of the description, spawns the helper process */
+		LV2VstBridge (audioMasterCallback, RtkLv2Description* desc, char const* const* bundles);
+		~LV2VstBridge ();
+
+		virtual void process (float**, float**, int32_t);
+		virtual int32_t process_events (VstEvents* events);
+
+		virtual float get_parameter (int32_t index);
+		virtual bool set_parameter (int32_t index, float value);
+		virtual void get_parameter_label (int32_t index, char* label);
+		virtual void get_parameter_display (int32_t index, char* text);
+		virtual void get_parameter_name (int32_t index, char* text);
+		virtual bool get_parameter_properties (int32_t index, VstParameterProperties* p);
+		virtual bool can_be_automated (int32_t index);
+
+		virtual bool get_effect_name (char* name);
+		virtual bool get_vendor_string (char* text);
+		virtual bool get_product_string (char* text);
+		virtual int32_t get_vendor_version ();
+
+		virtual void set_sample_rate (float sr);
+		virtual void set_block_size (int32_t bs);
+		virtual void resume ();
+		virtual void suspend ();
+
+		virtual int32_t get_chunk (void** data, bool is_preset);
+		virtual int32_t set_chunk (void* data, int32_t size, bool is_preset);
+
+		virtual int32_t can_do (char* text);
+		virtual int32_t bypass_plugin (bool bypass);
+
+		virtual VstPlugCategory get_category ();
+
+		bool dead () const { return __atomic_load_n (&_dead, __ATOMIC_ACQUIRE); }
+
+	private:
+		bool spawn (char const* const* bundles);
+		void reap ();
+		void cleanup ();
+
+		bool call (BridgeChannel* ch, int32_t op, int32_t index = 0, intptr_t value = 0, float opt = 0);
+		bool ctrl_call (int32_t op, int32_t index = 0, intptr_t value = 0, float opt = 0);
+		void ctrl_string (int32_t op, int32_t index, char* text, size_t len);
+		void host_callback (BridgeChannel* ch);
+
+		static bool alive (void* arg);
+
+		RtkLv2Description* _desc;
+
+		int        _fd;
+		BridgeShm* _shm;
+		size_t     _shm_size;
+		float*     _params;   ///< layout, computed once after instantiation
+		uint32_t*  _dirty;
+		float*     _audio;
+		pid_t      _pid;
+		bool       _dead;
+
+		pthread_mutex_t _ctrl_lock; ///< recursive, nested requests from callbacks
+
+		BridgeEvents* _events_in;  ///< from the host, sent with the next cycle
+		BridgeEvents* _events_out; ///< validated copy of BridgeShm::midi_out
+		VstEvents*    _list_in;
+		VstEvents*    _list_out;
+		bool          _sched_sent;
+
+		uint8_t* _chunk;
+};
+
+#endif
@@ -0,0 +1,203 @@
+/*
+ *  Copyright (C) 2016 Robin Gareus <robin@gareus.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/* Benchmark of the out-of-process bridge: time per process cycle of a
+ * plugin, in-process (LV2Vst) and bridged (LV2VstBridge, which needs
+ * lv2vst-bridge next to this tool).
+ *
+ * usage: bridgebench [-b <block-size>] [-n <cycles>] <plugin-uri>
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "bridge.h"
+#include "lv2vst.h"
+
+static int32_t     _block_size = 256;
+static VstTimeInfo _time_info;
+
+static intptr_t bench_master (AEffect*, int32_t opcode, int32_t, intptr_t, void* ptr, float)
+{
+	switch (opcode) {
+		case audioMasterVersion:
+			return 2400;
+		case audioMasterGetSampleRate:
+			return 48000;
+		case audioMasterGetBlockSize:
+			return _block_size;
+		case audioMasterGetTime:
+			return (intptr_t) &_time_info;
+		case audioMasterGetCurrentProcessLevel:
+			return kVstProcessLevelRealtime;
+		case audioMasterGetProductString:
+			strcpy ((char*) ptr, "bridgebench");
+			return 1;
+		default:
+			break;
+	}
+	return 0;
+}
+
+static int cmp_int64 (const void* a, const void* b)
+{
+	const int64_t d = *(const int64_t*)a - *(const int64_t*)b;
+	return d < 0 ? -1 : d > 0 ? 1 : 0;
+}
+
+static int64_t now_ns ()
+{
+	struct timespec ts;
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/* run `n_cycles` and print statistics, returns the median in nsec */
+static int64_t bench (const char* name, VstPlugin* p, uint32_t n_cycles)
+{
+	AEffect* e = p->get_effect ();
+	float** ins  = (float**) calloc (e->numInputs + 1, sizeof (float*));
+	float** outs = (float**) calloc (e->numOutputs + 1, sizeof (float*));
+	for (int32_t c = 0; c < e->numInputs; ++c) {
+		ins[c] = (float*) calloc (_block_size, sizeof (float));
+		for (int32_t i = 0; i < _block_size; ++i) {
+			ins[c][i] = .1f * sinf (i * .05f);
+		}
+	}
+	for (int32_t c = 0; c < e->numOutputs; ++c) {
+		outs[c] = (float*) calloc (_block_size, sizeof (float));
+	}
+
+	int64_t* t = (int64_t*) calloc (n_cycles, sizeof (int64_t));
+
+	p->set_sample_rate (48000);
+	p->set_block_size (_block_size);
+	p->resume ();
+
+	for (uint32_t i = 0; i < 100; ++i) { // warm up
+		p->process (ins, outs, _block_size);
+	}
+
+	for (uint32_t i = 0; i < n_cycles; ++i) {
+		const int64_t t0 = now_ns ();
+		p->process (ins, outs, _block_size);
+		t[i] = now_ns () - t0;
+		_time_info.samplePos += _block_size;
+	}
+
+	p->suspend ();
+
+	qsort (t, n_cycles, sizeof (int64_t), cmp_int64);
+	int64_t sum = 0;
+	for (uint32_t i = 0; i < n_cycles; ++i) {
+		sum += t[i];
+	}
+	const int64_t median = t[n_cycles / 2];
+	printf ("%-12s mean: %8.2f us  median: %8.2f us  p99: %8.2f us  max: %8.2f us\n", name,
+			sum / (1000. * n_cycles), median / 1000., t[(n_cycles * 99) / 100] / 1000., t[n_cycles - 1] / 1000.);
+
+	free (t);
+	for (int32_t c = 0; c < e->numInputs; ++c) {
+		free (ins[c]);
+	}
+	for (int32_t c = 0; c < e->numOutputs; ++c) {
+		free (outs[c]);
+	}
+	free (ins);
+	free (outs);
+	return median;
+}
+
+static void usage (const char* argv0)
+{
+	fprintf (stderr, "usage: %s [-b <block-size>] [-n <cycles>] <plugin-uri>\n", argv0);
+}
+
+int main (int argc, char** argv)
+{
+	uint32_t n_cycles = 10000;
+	int c;
+	while ((c = getopt (argc, argv, "b:n:h")) != -1) {
+		switch (c) {
+			case 'b':
+				_block_size = atoi (optarg);
+				break;
+			case 'n':
+				n_cycles = atoi (optarg);
+				break;
+			default:
+				usage (argv[0]);
+				return c == 'h' ? 0 : 1;
+		}
+	}
+	if (optind + 1 != argc || _block_size < 1 || n_cycles < 1) {
+		usage (argv[0]);
+		return 1;
+	}
+
+	const uint32_t id = uri_to_id (argv[optind]);
+
+	memset (&_time_info, 0, sizeof (VstTimeInfo));
+	_time_info.sampleRate = 48000;
+	_time_info.tempo = 120;
+	_time_info.timeSigNumerator = 4;
+	_time_info.timeSigDenominator = 4;
+	_time_info.flags = kVstTempoValid | kVstTimeSigValid | kVstTransportPlaying;
+
+	printf ("%s, %d samples per cycle, %u cycles\n", argv[optind], _block_size, n_cycles);
+
+	RtkLv2Description* desc = get_desc_by_id (id, NULL, true);
+	if (!desc) {
+		fprintf (stderr, "Plugin '%s' not found.\n", argv[optind]);
+		return 1;
+	}
+
+	int64_t t_local = 0;
+	int64_t t_bridge = 0;
+
+	try {
+		LV2Vst* p = new LV2Vst (bench_master, desc);
+		t_local = bench ("in-process", p, n_cycles);
+		delete p;
+	} catch (...) {
+		fprintf (stderr, "Instantiation failed.\n");
+		free_desc (desc);
+		return 1;
+	}
+
+	desc = get_desc_by_id (id, NULL, true);
+	if (!desc) {
+		return 1;
+	}
+	try {
+		LV2VstBridge* p = new LV2VstBridge (bench_master, desc, NULL);
+		t_bridge = bench ("bridged", p, n_cycles);
+		delete p;
+	} catch (...) {
+		fprintf (stderr, "Bridged instantiation failed.\n");
+		free_desc (desc);
+		return 1;
+	}
+
+	printf ("bridge overhead (median): %.2f us per cycle\n", (t_bridge - t_local) / 1000.);
+	return 0;
+}
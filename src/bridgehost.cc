@@ -0,0 +1,451 @@
+/*
+ *  Copyright (C) 2016 Robin Gareus <robin@gareus.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/* Helper process of the out-of-process bridge (BRIDGE=1): hosts a
+ * single LV2Vst instance, all I/O uses the shared memory segment
+ * which is created by LV2VstBridge, see bridge.h
+ *
+ * usage: lv2vst-bridge <fd> <vst-id> [bundle...]
+ */
+
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "bridge.h"
+#include "lv2vst.h"
+
+#define HELPER_POLL_MS 250 // check if the host is alive while waiting
+
+static BridgeShm* _shm    = 0;
+static LV2Vst*    _plugin = 0;
+static pid_t      _parent = 0;
+
+/* the channel served by the calling thread */
+static __thread BridgeChannel* _channel = 0;
+
+static float**     _ins  = 0;
+static float**     _outs = 0;
+static VstEvents*  _list_in = 0;
+static VstTimeInfo _time_info;
+
+static int _sched_policy = SCHED_OTHER;
+static int _sched_priority = 0;
+
+static uint8_t* _chunk_out = 0;
+static int32_t  _chunk_out_size = 0;
+static uint8_t* _chunk_in = 0;
+static size_t   _chunk_in_size = 0;
+
+static pthread_t _rt_thread;
+static bool      _rt_running = false;
+
+static void serve (BridgeChannel* ch);
+
+static bool parent_alive (void*)
+{
+	return getppid () == _parent;
+}
+
+static void reply (BridgeChannel* ch, int64_t ret)
+{
+	ch->ret = ret;
+	ch->op = BridgeReply;
+	bridge_pass (ch, BridgePluginSide);
+}
+
+/* ****************************************************************************
+ * Host callbacks
+ */
+
+/* call the host's audioMaster, serve nested requests until it returns */
+static intptr_t host_call (BridgeChannel* ch, int32_t opcode, int32_t index, intptr_t value, float opt)
+{
+	ch->op     = BridgeCallback;
+	ch->opcode = opcode;
+	ch->index  = index;
+	ch->value  = value;
+	ch->opt    = opt;
+	bridge_pass (ch, BridgePluginSide);
+
+	while (bridge_wait (ch, BridgeHelperSide, BRIDGE_SPIN_US, HELPER_POLL_MS, 0, &parent_alive, 0)) {
+		if (ch->op == BridgeReply) {
+			return ch->ret;
+		}
+		serve (ch);
+	}
+	exit (1); // host is gone
+}
+
+static intptr_t host_master (AEffect* e, int32_t opcode, int32_t index, intptr_t value, void* ptr, float opt)
+{
+	BridgeChannel* ch = _channel;
+	if (!ch) {
+		/* not called from a thread which serves a channel */
+		return 0;
+	}
+	const bool rt = ch == &_shm->rt;
+
+	switch (opcode) {
+		case audioMasterGetTime:
+			if (rt) {
+				/* queried by the plugin once per cycle */
+				return _shm->has_time ? (intptr_t) &_shm->time_info : 0;
+			}
+			if (!host_call (ch, opcode, index, value, opt)) {
+				return 0;
+			}
+			memcpy (&_time_info, ch->data, sizeof (VstTimeInfo));
+			return (intptr_t) &_time_info;
+		case audioMasterGetCurrentProcessLevel:
+			if (rt) {
+				return _shm->process_level;
+			}
+			break;
+		case audioMasterProcessEvents:
+			if (rt && ptr) {
+				VstEvents* events = (VstEvents*) ptr;
+				for (int32_t i = 0; i < events->numEvents; ++i) {
+					bridge_event_add (&_shm->midi_out, events->events[i], 0);
+				}
+				return 1;
+			}
+			return 0;
+		case audioMasterIOChanged:
+			if (e) {
+				_shm->initial_delay = e->initialDelay;
+			}
+			break;
+		case audioMasterCanDo:
+			strncpy (ch->data, ptr ? (const char*) ptr : "", BRIDGE_DATA_SIZE - 1);
+			ch->data[BRIDGE_DATA_SIZE - 1] = 0;
+			break;
+		case audioMasterGetVendorString:
+		case audioMasterGetProductString:
+			{
+				ch->data[0] = 0;
+				intptr_t rv = host_call (ch, opcode, index, value, opt);
+				if (ptr) {
+					strncpy ((char*) ptr, ch->data, 63);
+					((char*) ptr)[63] = 0;
+				}
+				return rv;
+			}
+		case audioMasterSizeWindow:
+			return 0; // no GUI
+		default:
+			break;
+	}
+	return host_call (ch, opcode, index, value, opt);
+}
+
+/* ****************************************************************************
+ * Requests
+ */
+
+static void update_params ()
+{
+	float* params = bridge_params (_shm);
+	for (int32_t i = 0; i < _shm->num_params; ++i) {
+		params[i] = _plugin->get_parameter (i);
+	}
+}
+
+static void process ()
+{
+	BridgeShm* s = _shm;
+
+	if (s->sched_policy != _sched_policy || s->sched_priority != _sched_priority) {
+		struct sched_param sp;
+		memset (&sp, 0, sizeof (struct sched_param));
+		sp.sched_priority = s->sched_priority;
+		pthread_setschedparam (pthread_self (), s->sched_policy, &sp);
+		_sched_policy = s->sched_policy;
+		_sched_priority = s->sched_priority;
+	}
+
+	/* parameter changes since the last cycle */
+	uint32_t* dirty = bridge_dirty (s, s->num_params);
+	for (int32_t w = 0; w < (s->num_params + 31) / 32; ++w) {
+		if (!__atomic_load_n (&dirty[w], __ATOMIC_RELAXED)) {
+			continue;
+		}
+		uint32_t bits = __atomic_exchange_n (&dirty[w], 0, __ATOMIC_ACQUIRE);
+		while (bits) {
+			const uint32_t p = 32 * w + __builtin_ctz (bits);
+			bits &= bits - 1;
+			_plugin->set_parameter (p, bridge_param_get (bridge_params (s), p));
+		}
+	}
+
+	if (s->midi_in.n_events > 0) {
+		_plugin->process_events (bridge_events (&s->midi_in, _list_in));
+	}
+
+	_plugin->process (_ins, _outs, s->n_samples);
+}
+
+static void serve (BridgeChannel* ch)
+{
+	LV2Vst* p = _plugin;
+	int64_t ret = 0;
+
+	switch (ch->op) {
+		case BridgeProcess:
+			process ();
+			break;
+		case BridgeSetSampleRate:
+			p->set_sample_rate (ch->opt);
+			break;
+		case BridgeSetBlockSize:
+			p->set_block_size (ch->value);
+			break;
+		case BridgeResume:
+			p->resume ();
+			break;
+		case BridgeSuspend:
+			p->suspend ();
+			break;
+		case BridgeGetParameterLabel:
+			ch->data[0] = 0;
+			p->get_parameter_label (ch->index, ch->data);
+			break;
+		case BridgeGetParameterDisplay:
+			ch->data[0] = 0;
+			p->get_parameter_display (ch->index, ch->data);
+			break;
+		case BridgeGetParameterName:
+			ch->data[0] = 0;
+			p->get_parameter_name (ch->index, ch->data);
+			break;
+		case BridgeGetParameterProperties:
+			memset (ch->data, 0, sizeof (VstParameterProperties));
+			ret = p->get_parameter_properties (ch->index, (VstParameterProperties*) ch->data);
+			break;
+		case BridgeCanBeAutomated:
+			ret = p->can_be_automated (ch->index);
+			break;
+		case BridgeGetEffectName:
+			ch->data[0] = 0;
+			ret = p->get_effect_name (ch->data);
+			break;
+		case BridgeGetVendorString:
+			ch->data[0] = 0;
+			ret = p->get_vendor_string (ch->data);
+			break;
+		case BridgeGetProductString:
+			ch->data[0] = 0;
+			ret = p->get_product_string (ch->data);
+			break;
+		case BridgeGetVendorVersion:
+			ret = p->get_vendor_version ();
+			break;
+		case BridgeGetCategory:
+			ret = p->get_category ();
+			break;
+		case BridgeCanDo:
+			ret = p->can_do (ch->data);
+			break;
+		case BridgeBypass:
+			ret = p->bypass_plugin (ch->value != 0);
+			break;
+		case BridgeGetChunk:
+			{
+				void* data = 0;
+				free (_chunk_out);
+				_chunk_out_size = p->get_chunk (&data, ch->value != 0);
+				_chunk_out = (uint8_t*) data;
+				if (!_chunk_out || _chunk_out_size < 0) {
+					_chunk_out_size = 0;
+				}
+				ret = _chunk_out_size;
+			}
+			break;
+		case BridgeGetChunkData:
+			if (ch->index >= 0 && ch->index < _chunk_out_size) {
+				const int32_t n = _chunk_out_size - ch->index;
+				ret = n > BRIDGE_DATA_SIZE ? BRIDGE_DATA_SIZE : n;
+				memcpy (ch->data, &_chunk_out[ch->index], ret);
+			}
+			break;
+		case BridgeSetChunkData:
+			if (ch->index >= 0 && ch->value > 0 && ch->value <= BRIDGE_DATA_SIZE) {
+				if ((size_t)(ch->index + ch->value) > _chunk_in_size) {
+					_chunk_in_size = ch->index + ch->value;
+					_chunk_in = (uint8_t*) realloc (_chunk_in, _chunk_in_size);
+				}
+				memcpy (&_chunk_in[ch->index], ch->data, ch->value);
+				ret = 1;
+			}
+			break;
+		case BridgeSetChunk:
+			if (ch->value <= (int64_t)_chunk_in_size) {
+				ret = p->set_chunk (_chunk_in, ch->value, ch->index != 0);
+			}
+			free (_chunk_in);
+			_chunk_in = 0;
+			_chunk_in_size = 0;
+			update_params ();
+			break;
+		default:
+			break;
+	}
+
+	_shm->initial_delay = p->get_effect ()->initialDelay;
+	reply (ch, ret);
+}
+
+static void* rt_main (void*)
+{
+	BridgeChannel* ch = &_shm->rt;
+	_channel = ch;
+	while (bridge_wait (ch, BridgeHelperSide, 0, HELPER_POLL_MS, 0, &parent_alive, 0)) {
+		if (ch->op == BridgeQuit) {
+			reply (ch, 0);
+			break;
+		}
+		serve (ch);
+	}
+	return 0;
+}
+
+/* ****************************************************************************
+ * Setup
+ */
+
+static bool instantiate (int fd, uint32_t id, char const* const* bundles)
+{
+	RtkLv2Description* desc = get_desc_by_id (id, bundles, true);
+	if (!desc) {
+		fprintf (stderr, "LV2Bridge: Failed to parse lv2 ttl.\n");
+		return false;
+	}
+
+	try {
+		_plugin = new LV2Vst (host_master, desc);
+	} catch (...) {
+		fprintf (stderr, "LV2Bridge: instantiation failed\n");
+		free_desc (desc);
+		return false;
+	}
+
+	AEffect const* e = _plugin->get_effect ();
+	_shm->num_inputs     = e->numInputs;
+	_shm->num_outputs    = e->numOutputs;
+	_shm->num_params     = e->numParams;
+	_shm->flags          = e->flags;
+	_shm->unique_id      = e->uniqueID;
+	_shm->plugin_version = e->version;
+	_shm->initial_delay  = e->initialDelay;
+
+	/* grow the segment for parameters and audio buffers */
+	const size_t size = bridge_size (_shm->num_params, _shm->num_inputs + _shm->num_outputs);
+	if (ftruncate (fd, size)) {
+		return false;
+	}
+	void* shm = mmap (NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (shm == MAP_FAILED) {
+		return false;
+	}
+	munmap (_shm, sizeof (BridgeShm));
+	_shm = (BridgeShm*) shm;
+	_shm->size = size;
+	_channel = &_shm->ctrl;
+
+	update_params ();
+
+	_ins  = (float**) calloc (_shm->num_inputs + 1, sizeof (float*));
+	_outs = (float**) calloc (_shm->num_outputs + 1, sizeof (float*));
+	for (int32_t c = 0; c < _shm->num_inputs; ++c) {
+		_ins[c] = bridge_audio (_shm, _shm->num_params, c);
+	}
+	for (int32_t c = 0; c < _shm->num_outputs; ++c) {
+		_outs[c] = bridge_audio (_shm, _shm->num_params, _shm->num_inputs + c);
+	}
+	_list_in = bridge_alloc_events ();
+
+	if (pthread_create (&_rt_thread, NULL, rt_main, NULL)) {
+		return false;
+	}
+	_rt_running = true;
+	return true;
+}
+
+int main (int argc, char** argv)
+{
+	if (argc < 3) {
+		fprintf (stderr, "usage: %s <fd> <vst-id> [bundle...]\n"
+				"This helper is started by the lv2vst plugin.\n", argv[0]);
+		return 1;
+	}
+
+	const int      fd = atoi (argv[1]);
+	const uint32_t id = strtoul (argv[2], NULL, 16);
+	char const* const* bundles = argc > 3 ? &argv[3] : NULL;
+
+	_parent = getppid ();
+
+	_shm = (BridgeShm*) mmap (NULL, sizeof (BridgeShm), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (_shm == MAP_FAILED || _shm->magic != BRIDGE_MAGIC || _shm->version != BRIDGE_VERSION) {
+		fprintf (stderr, "LV2Bridge: invalid shared memory segment\n");
+		return 1;
+	}
+
+	BridgeChannel* ch = &_shm->ctrl;
+	_channel = ch;
+
+	if (!bridge_wait (ch, BridgeHelperSide, 0, HELPER_POLL_MS, 0, &parent_alive, 0) || ch->op != BridgeInstantiate) {
+		return 1;
+	}
+
+	if (!instantiate (fd, id, bundles)) {
+		reply (_channel, 0);
+		return 1;
+	}
+
+	ch = _channel;
+	reply (ch, 1);
+
+	bool quit = false;
+	while (bridge_wait (ch, BridgeHelperSide, 0, HELPER_POLL_MS, 0, &parent_alive, 0)) {
+		if (ch->op == BridgeQuit) {
+			quit = true;
+			break;
+		}
+		serve (ch);
+	}
+
+	if (_rt_running) {
+		pthread_join (_rt_thread, NULL);
+	}
+	delete _plugin;
+
+	if (quit) {
+		reply (ch, 0);
+	}
+
+	free (_ins);
+	free (_outs);
+	free (_list_in);
+	free (_chunk_out);
+	free (_chunk_in);
+	munmap (_shm, _shm->size);
+	return 0;
+}
@@ -0,0 +1,575 @@
+/*
+ *  Copyright (C) 2016 Robin Gareus <robin@gareus.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+# include <winsock2.h>
+# include <windows.h>
+#else
+# include <arpa/inet.h>
+#endif
+
+#include "chain.h"
+#include "lv2ttl.h"
+
+#define CHAIN_ALIGN 64 // scratch buffers are cache-line aligned
+
+__thread LV2VstChain* LV2VstChain::_constructing = 0;
+
+LV2VstChain::LV2VstChain (audioMasterCallback audioMaster, RtkLv2Description** desc, uint32_t n_stages)
+	: VstPlugin (audioMaster, 0)
+	, _stages (0)
+	, _n_stages (0)
+	, _param_offset (0)
+	, _n_scratch (0)
+	, _scratch_len (0)
+	, _scratch_mem (0)
+	, _silence (0)
+	, _stage_in (0)
+	, _stage_out (0)
+	, _in_process (false)
+	, _ti (0)
+	, _process_level (0)
+	, _chunk (0)
+{
+	_stages = (LV2Vst**) calloc (n_stages, sizeof (LV2Vst*));
+	_param_offset = (int32_t*) calloc (n_stages + 1, sizeof (int32_t));
+	_scratch[0] = _scratch[1] = 0;
+
+	/* stages may call the host during construction, before
+	 * their AEffect can be associated with the chain */
+	_constructing = this;
+	for (uint32_t k = 0; k < n_stages; ++k) {
+		try {
+			_stages[k] = new LV2Vst (stage_master, desc[k]);
+		} catch (...) {
+			_constructing = 0;
+			fprintf (stderr, "LV2Host: failed to instantiate chain stage %u '%s'.\n", k + 1, desc[k]->dsp_uri);
+			for (uint32_t j = k; j < n_stages; ++j) {
+				free_desc (desc[j]);
+			}
+			_n_stages = 0;
+			for (uint32_t j = 0; j < k; ++j) {
+				delete _stages[j];
+			}
+			free (_stages);
+			free (_param_offset);
+			throw;
+		}
+		_stages[k]->get_effect ()->user = this;
+		_param_offset[k + 1] = _param_offset[k] + _stages[k]->get_effect ()->numParams;
+		++_n_stages;
+	}
+	_constructing = 0;
+
+	AEffect const* first = _stages[0]->get_effect ();
+	AEffect const* last  = _stages[_n_stages - 1]->get_effect ();
+
+	uint32_t n_ports = 0;
+	memset (_name, 0, sizeof (_name));
+	char* uris = (char*) calloc (1, 1);
+	for (uint32_t k = 0; k < _n_stages; ++k) {
+		AEffect const* e = _stages[k]->get_effect ();
+		if (k + 1 < _n_stages && (uint32_t) e->numOutputs > _n_scratch) {
+			_n_scratch = e->numOutputs;
+		}
+		if ((uint32_t) e->numInputs > n_ports) {
+			n_ports = e->numInputs;
+		}
+		if ((uint32_t) e->numOutputs > n_ports) {
+			n_ports = e->numOutputs;
+		}
+		if (e->flags & (1 << 5)) {
+			_effect.flags |= (1 << 5);  // effFlagsProgramChunks;
+		}
+		const size_t len = strlen (_name);
+		snprintf (&_name[len], sizeof (_name) - len, "%s%s", k > 0 ? " > " : "", _stages[k]->desc ()->plugin_name);
+		const char* uri = _stages[k]->desc ()->dsp_uri;
+		uris = (char*) realloc (uris, strlen (uris) + strlen (uri) + 2);
+		strcat (uris, uri);
+		strcat (uris, "\n");
+	}
+
+	_stage_in  = (float**) calloc (n_ports + 1, sizeof (float*));
+	_stage_out = (float**) calloc (n_ports + 1, sizeof (float*));
+
+	_effect.numInputs = first->numInputs;
+	_effect.numOutputs = last->numOutputs;
+	_effect.numParams = _param_offset[_n_stages];
+	_effect.uniqueID = uri_to_id (uris);
+	_effect.flags |= effFlagsCanReplacing;
+	_effect.flags |= first->flags & effFlagsIsSynth;
+	_effect.version = first->version;
+	_n_params = _effect.numParams;
+	free (uris);
+
+	update_block_size ();
+	alloc_scratch ();
+	update_latency ();
+}
+
+LV2VstChain::~LV2VstChain ()
+{
+	/* stages may call the host while they are suspended or destroyed
+	 * (latency changes), those callbacks must not access any stage */
+	for (uint32_t k = 0; k < _n_stages; ++k) {
+		_stages[k]->suspend ();
+	}
+	const uint32_t n_stages = _n_stages;
+	_n_stages = 0;
+	for (uint32_t k = 0; k < n_stages; ++k) {
+		delete _stages[k];
+	}
+	free (_stages);
+	free (_param_offset);
+	free (_scratch_mem);
+	free (_scratch[0]);
+	free (_scratch[1]);
+	free (_stage_in);
+	free (_stage_out);
+	free (_chunk);
+}
+
+/* ****************************************************************************
+ * Host callbacks of the stages
+ */
+
+intptr_t LV2VstChain::stage_master (AEffect* e, int32_t opcode, int32_t index, intptr_t value, void* ptr, float opt)
+{
+	LV2VstChain* self = (e && e->user) ? (LV2VstChain*) e->user : _constructing;
+	if (!self) {
+		return 0;
+	}
+	return self->stage_callback (self->stage_index (e), opcode, index, value, ptr, opt);
+}
+
+uint32_t LV2VstChain::stage_index (AEffect* e) const
+{
+	for (uint32_t k = 0; k < _n_stages; ++k) {
+		if (_stages[k]->get_effect () == e) {
+			return k;
+		}
+	}
+	return _n_stages; // currently being constructed
+}
+
+intptr_t LV2VstChain::stage_callback (uint32_t k, int32_t opcode, int32_t index, intptr_t value, void* ptr, float opt)
+{
+	switch (opcode) {
+		case audioMasterAutomate:
+			if (k >= _n_stages) {
+				return 0;
+			}
+			index += _param_offset[k];
+			break;
+		case audioMasterGetTime:
+			/* one query per cycle, shared by all stages */
+			if (_in_process) {
+				return (intptr_t) _ti;
+			}
+			break;
+		case audioMasterGetCurrentProcessLevel:
+			if (_in_process) {
+				return _process_level;
+			}
+			break;
+		case audioMasterProcessEvents:
+			/* MIDI output is passed to the next stage, the last one sends to the host */
+			if (k + 1 < _n_stages) {
+				_stages[k + 1]->process_events ((VstEvents*) ptr);
+				return 1;
+			}
+			break;
+		case audioMasterIOChanged:
+			update_latency ();
+			break;
+		case audioMasterSizeWindow:
+			return 0; // no editor
+		default:
+			break;
+	}
+	return audioMaster (&_effect, opcode, index, value, ptr, opt);
+}
+
+void LV2VstChain::update_latency ()
+{
+	int32_t latency = 0;
+	for (uint32_t k = 0; k < _n_stages; ++k) {
+		latency += _stages[k]->get_effect ()->initialDelay;
+	}
+	_effect.initialDelay = latency;
+}
+
+/* ****************************************************************************
+ * Processing
+ */
+
+void LV2VstChain::alloc_scratch ()
+{
+	if (_scratch_len == _block_size && _scratch_mem) {
+		return;
+	}
+	free (_scratch_mem);
+	free (_scratch[0]);
+	free (_scratch[1]);
+
+	_scratch_len = _block_size;
+	const size_t stride = (_scratch_len * sizeof (float) + CHAIN_ALIGN - 1) & ~(size_t)(CHAIN_ALIGN - 1);
+	_scratch_mem = calloc (1, (2 * _n_scratch + 1) * stride + CHAIN_ALIGN);
+
+	uint8_t* buf = (uint8_t*) (((uintptr_t)_scratch_mem + CHAIN_ALIGN - 1) & ~(uintptr_t)(CHAIN_ALIGN - 1));
+	_silence = (float*) buf;
+	buf += stride;
+
+	for (uint32_t s = 0; s < 2; ++s) {
+		_scratch[s] = (float**) calloc (_n_scratch + 1, sizeof (float*));
+		for (uint32_t c = 0; c < _n_scratch; ++c) {
+			_scratch[s][c] = (float*) buf;
+			buf += stride;
+		}
+	}
+}
+
+void LV2VstChain::process (float** inputs, float** outputs, int32_t n_samples)
+{
+	/* VST hosts must not exceed the block-size */
+	if (n_samples > _scratch_len) {
+		for (int32_t c = 0; c < _effect.numOutputs; ++c) {
+			memset (outputs[c], 0, n_samples * sizeof (float));
+		}
+		return;
+	}
+
+	_ti = get_time_info (kVstPpqPosValid | kVstBarsValid | kVstTimeSigValid | kVstTempoValid);
+	_process_level = get_process_level ();
+	_in_process = true;
+
+	float** in = inputs;
+	int32_t n_in = _effect.numInputs;
+
+	for (uint32_t k = 0; k < _n_stages; ++k) {
+		AEffect const* e = _stages[k]->get_effect ();
+		float** out = (k + 1 == _n_stages) ? outputs : _scratch[k & 1];
+
+		for (int32_t c = 0; c < e->numInputs; ++c) {
+			_stage_in[c] = c < n_in ? in[c] : _silence;
+		}
+		for (int32_t c = 0; c < e->numOutputs; ++c) {
+			_stage_out[c] = out[c];
+		}
+
+		_stages[k]->process (_stage_in, _stage_out, n_samples);
+
+		in = out;
+		n_in = e->numOutputs;
+	}
+
+	_in_process = false;
+}
+
+int32_t LV2VstChain::process_events (VstEvents* events)
+{
+	return _stages[0]->process_events (events);
+}
+
+void LV2VstChain::set_sample_rate (float sr)
+{
+	VstPlugin::set_sample_rate (sr);
+	for (uint32_t k = 0; k < _n_stages; ++k) {
+		_stages[k]->set_sample_rate (sr);
+	}
+}
+
+void LV2VstChain::set_block_size (int32_t bs)
+{
+	VstPlugin::set_block_size (bs);
+	for (uint32_t k = 0; k < _n_stages; ++k) {
+		_stages[k]->set_block_size (bs);
+	}
+	alloc_scratch ();
+}
+
+void LV2VstChain::resume ()
+{
+	for (uint32_t k = 0; k < _n_stages; ++k) {
+		_stages[k]->resume ();
+	}
+	update_latency ();
+}
+
+void LV2VstChain::suspend ()
+{
+	for (uint32_t k = 0; k < _n_stages; ++k) {
+		_stages[k]->suspend ();
+	}
+}
+
+int32_t LV2VstChain::bypass_plugin (bool bypass)
+{
+	int32_t rv = 1;
+	for (uint32_t k = 0; k < _n_stages; ++k) {
+		if (!_stages[k]->bypass_plugin (bypass)) {
+			rv = 0;
+		}
+	}
+	return rv;
+}
+
+/* ****************************************************************************
+ * Parameters, flattened
+ */
+
+uint32_t LV2VstChain::stage_param (int32_t index, int32_t* local) const
+{
+	if (index < 0) {
+		return _n_stages;
+	}
+	for (uint32_t k = 0; k < _n_stages; ++k) {
+		if (index < _param_offset[k + 1]) {
+			*local = index - _param_offset[k];
+			return k;
+		}
+	}
+	return _n_stages;
+}
+
+float LV2VstChain::get_parameter (int32_t index)
+{
+	int32_t i;
+	uint32_t k = stage_param (index, &i);
+	return k < _n_stages ? _stages[k]->get_parameter (i) : 0;
+}
+
+bool LV2VstChain::set_parameter (int32_t index, float value)
+{
+	int32_t i;
+	uint32_t k = stage_param (index, &i);
+	return k < _n_stages ? _stages[k]->set_parameter (i, value) : false;
+}
+
+void LV2VstChain::get_parameter_label (int32_t index, char* label)
+{
+	int32_t i;
+	uint32_t k = stage_param (index, &i);
+	if (k < _n_stages) {
+		_stages[k]->get_parameter_label (i, label);
+	}
+}
+
+void LV2VstChain::get_parameter_display (int32_t index, char* text)
+{
+	int32_t i;
+	uint32_t k = stage_param (index, &i);
+	if (k < _n_stages) {
+		_stages[k]->get_parameter_display (i, text);
+	}
+}
+
+/* parameter names are prefixed with the stage number "1:name" */
+void LV2VstChain::get_parameter_name (int32_t index, char* text)
+{
+	int32_t i;
+	uint32_t k = stage_param (index, &i);
+	if (k < _n_stages) {
+		char name[257] = "";
+		_stages[k]->get_parameter_name (i, name);
+		snprintf (text, _stages[k]->param_name_len () + 1, "%u:%s", k + 1, name);
+	}
+}
+
+bool LV2VstChain::get_parameter_properties (int32_t index, VstParameterProperties* p)
+{
+	int32_t i;
+	uint32_t k = stage_param (index, &i);
+	if (k >= _n_stages || !_stages[k]->get_parameter_properties (i, p)) {
+		return false;
+	}
+	char label[sizeof (p->label) + 1];
+	memcpy (label, p->label, sizeof (p->label));
+	label[sizeof (p->label)] = 0;
+	snprintf (p->label, sizeof (p->label), "%u:%.52s", k + 1, label);
+	p->displayIndex = index;
+	return true;
+}
+
+bool LV2VstChain::can_be_automated (int32_t index)
+{
+	int32_t i;
+	uint32_t k = stage_param (index, &i);
+	return k < _n_stages && _stages[k]->can_be_automated (i);
+}
+
+/* ****************************************************************************
+ * Info
+ */
+
+bool LV2VstChain::get_effect_name (char* name)
+{
+	snprintf (name, 33, "%.32s", _name);
+	return true;
+}
+
+bool LV2VstChain::get_product_string (char* text)
+{
+	snprintf (text, 65, "%s", _name);
+	return true;
+}
+
+bool LV2VstChain::get_vendor_string (char* text)
+{
+	return _stages[0]->get_vendor_string (text);
+}
+
+int32_t LV2VstChain::get_vendor_version ()
+{
+	return _stages[0]->get_vendor_version ();
+}
+
+VstPlugCategory LV2VstChain::get_category ()
+{
+	return _stages[0]->get_category ();
+}
+
+int32_t LV2VstChain::can_do (char* text)
+{
+	if (!strcmp ("sendVstEvents", text) || !strcmp ("sendVstMidiEvent", text)) {
+		return _stages[_n_stages - 1]->can_do (text);
+	}
+	if (!strcmp ("receiveVstTimeInfo", text)) {
+		for (uint32_t k = 0; k < _n_stages; ++k) {
+			if (_stages[k]->can_do (text)) {
+				return 1;
+			}
+		}
+		return 0;
+	}
+	return _stages[0]->can_do (text);
+}
+
+/* ****************************************************************************
+ * State: [n_stages] followed by [size, chunk] of each stage
+ */
+
+int32_t LV2VstChain::get_chunk (void** data, bool is_preset)
+{
+	size_t size = sizeof (uint32_t);
+	void** chunks = (void**) calloc (_n_stages, sizeof (void*));
+	int32_t* sizes = (int32_t*) calloc (_n_stages, sizeof (int32_t));
+
+	for (uint32_t k = 0; k < _n_stages; ++k) {
+		sizes[k] = _stages[k]->get_chunk (&chunks[k], is_preset);
+		if (sizes[k] < 0 || !chunks[k]) {
+			sizes[k] = 0;
+		}
+		size += sizeof (uint32_t) + sizes[k];
+	}
+
+	free (_chunk);
+	_chunk = (uint8_t*) malloc (size);
+	uint8_t* d = _chunk;
+	uint32_t v;
+
+	v = htonl (_n_stages); memcpy (d, &v, sizeof (uint32_t)); d += sizeof (uint32_t);
+	for (uint32_t k = 0; k < _n_stages; ++k) {
+		v = htonl (sizes[k]); memcpy (d, &v, sizeof (uint32_t)); d += sizeof (uint32_t);
+		if (sizes[k] > 0) {
+			memcpy (d, chunks[k], sizes[k]);
+			d += sizes[k];
+		}
+		free (chunks[k]);
+	}
+	free (chunks);
+	free (sizes);
+
+	*data = _chunk;
+	return size;
+}
+
+int32_t LV2VstChain::set_chunk (void* data, int32_t size, bool is_preset)
+{
+	uint8_t* d = (uint8_t*) data;
+	uint32_t v;
+	if (size < (int32_t) sizeof (uint32_t)) {
+		return 0;
+	}
+	memcpy (&v, d, sizeof (uint32_t)); d += sizeof (uint32_t); size -= sizeof (uint32_t);
+	if (ntohl (v) != _n_stages) {
+		fprintf (stderr, "LV2Host: chain state does not match (%u != %u stages)\n", ntohl (v), _n_stages);
+		return 0;
+	}
+	for (uint32_t k = 0; k < _n_stages; ++k) {
+		if (size < (int32_t) sizeof (uint32_t)) {
+			return 0;
+		}
+		memcpy (&v, d, sizeof (uint32_t)); d += sizeof (uint32_t); size -= sizeof (uint32_t);
+		const int32_t len = ntohl (v);
+		if (len < 0 || len > size) {
+			return 0;
+		}
+		if (len > 0) {
+			_stages[k]->set_chunk (d, len, is_preset);
+		}
+		d += len;
+		size -= len;
+	}
+	return 1;
+}
+
+/* ****************************************************************************/
+
+VstPlugin* instantiate_chain (audioMasterCallback audioMaster, char const* const* uris, char const* const* bundles)
+{
+	uint32_t n = 0;
+	RtkLv2Description** desc = NULL;
+
+	for (uint32_t i = 0; uris[i]; ++i) {
+		const char* uri = uris[i];
+		if (!uri[0] || uri[0] == '#') {
+			continue;
+		}
+		RtkLv2Description* d = get_desc_by_id (uri_to_id (uri), bundles, true);
+		if (!d) {
+			fprintf (stderr, "LV2Host: chain plugin '%s' is not available.\n", uri);
+			for (uint32_t k = 0; k < n; ++k) {
+				free_desc (desc[k]);
+			}
+			free (desc);
+			return NULL;
+		}
+		desc = (RtkLv2Description**) realloc (desc, (n + 1) * sizeof (RtkLv2Description*));
+		desc[n++] = d;
+	}
+
+	if (n == 0) {
+		fprintf (stderr, "LV2Host: empty plugin chain.\n");
+		return NULL;
+	}
+
+	VstPlugin* chain = NULL;
+	try {
+		chain = new LV2VstChain (audioMaster, desc, n);
+	} catch (...) {
+		fprintf (stderr, "LV2Host: chain instantiation failed\n");
+	}
+	free (desc);
+	return chain;
+}
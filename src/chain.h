@@ -0,0 +1,105 @@
+/*
+ *  Copyright (C) 2016 Robin Gareus <robin@gareus.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef _lv2vst_chain_h_
+#define _lv2vst_chain_h_
+
+#include "vst.h"
+#include "lv2vst.h"
+
+/* several LV2 plugins in series, exposed as a single VST.
+ *
+ * Each stage is a LV2Vst instance which talks to the host via
+ * stage_master (): time-info and process-level are queried once per
+ * cycle, MIDI output of a stage is passed to the next stage, parameters
+ * are flattened (prefixed with the stage number) and the state of all
+ * stages is saved as a single chunk.
+ */
+class LV2VstChain : public VstPlugin
+{
+	public:
+		/* takes ownership of the descriptions */
+		LV2VstChain (audioMasterCallback, RtkLv2Description** desc, uint32_t n_stages);
+		~LV2VstChain ();
+
+		virtual void process (float**, float**, int32_t);
+		virtual int32_t process_events (VstEvents* events);
+
+		virtual float get_parameter (int32_t index);
+		virtual bool set_parameter (int32_t index, float value);
+		virtual void get_parameter_label (int32_t index, char* label);
+		virtual void get_parameter_display (int32_t index, char* text);
+		virtual void get_parameter_name (int32_t index, char* text);
+		virtual bool get_parameter_properties (int32_t index, VstParameterProperties* p);
+		virtual bool can_be_automated (int32_t index);
+
+		virtual bool get_effect_name (char* name);
+		virtual bool get_vendor_string (char* text);
+		virtual bool get_product_string (char* text);
+		virtual int32_t get_vendor_version ();
+
+		virtual void set_sample_rate (float sr);
+		virtual void set_block_size (int32_t bs);
+		virtual void resume ();
+		virtual void suspend ();
+
+		virtual int32_t get_chunk (void** data, bool is_preset);
+		virtual int32_t set_chunk (void* data, int32_t size, bool is_preset);
+
+		virtual int32_t can_do (char* text);
+		virtual int32_t bypass_plugin (bool bypass);
+
+		virtual VstPlugCategory get_category ();
+
+	private:
+		static intptr_t stage_master (AEffect*, int32_t opcode, int32_t index, intptr_t value, void* ptr, float opt);
+		intptr_t stage_callback (uint32_t stage, int32_t opcode, int32_t index, intptr_t value, void* ptr, float opt);
+
+		uint32_t stage_param (int32_t index, int32_t* local) const;
+		uint32_t stage_index (AEffect* e) const;
+		void update_latency ();
+		void alloc_scratch ();
+
+		LV2Vst** _stages;
+		uint32_t _n_stages;
+		int32_t* _param_offset; ///< first VST parameter of each stage
+
+		/* scratch buffers between stages, ping-pong */
+		uint32_t _n_scratch;    ///< channels per set
+		int32_t  _scratch_len;  ///< samples per channel
+		void*    _scratch_mem;
+		float**  _scratch[2];
+		float*   _silence;      ///< for unconnected inputs
+		float**  _stage_in;
+		float**  _stage_out;
+
+		/* per cycle */
+		bool         _in_process;
+		VstTimeInfo* _ti;
+		int32_t      _process_level;
+
+		uint8_t* _chunk;
+		char     _name[64];
+
+		static __thread LV2VstChain* _constructing;
+};
+
+/* .chain file: one plugin URI per line */
+VstPlugin* instantiate_chain (audioMasterCallback audioMaster, char const* const* uris, char const* const* bundles);
+
+#endif
@@ -0,0 +1,94 @@
+/*
+ *  Copyright (C) 2016 Robin Gareus <robin@gareus.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef _dirtyvalues_h_
+#define _dirtyvalues_h_
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+namespace Lv2VstUtil {
+
+/* latest value per port and a dirty bit-set.
+ *
+ * Any thread may set() a value, a single reader collects changed
+ * values with take() at its own pace; intermediate values are skipped.
+ * The value is stored before the dirty-bit is set (release), the
+ * reader atomically clears the bits (acquire) before reading the values.
+ * A value that is updated concurrently is flagged again and will be
+ * reported by the next take().
+ */
+class DirtyValues
+{
+	public:
+		DirtyValues (uint32_t n)
+			: _n_words ((n + 31) / 32)
+		{
+			_val   = (float*) calloc (n > 0 ? n : 1, sizeof (float));
+			_dirty = (uint32_t*) calloc (_n_words > 0 ? _n_words : 1, sizeof (uint32_t));
+		}
+
+		~DirtyValues () {
+			free (_val);
+			free (_dirty);
+		}
+
+		void set (uint32_t p, float v) {
+			__atomic_store_n ((uint32_t*)&_val[p], float_bits (v), __ATOMIC_RELAXED);
+			__atomic_fetch_or (&_dirty[p >> 5], 1U << (p & 31), __ATOMIC_RELEASE);
+		}
+
+		void reset () {
+			for (uint32_t w = 0; w < _n_words; ++w) {
+				__atomic_store_n (&_dirty[w], 0, __ATOMIC_RELAXED);
+			}
+		}
+
+		uint32_t n_words () const { return _n_words; }
+
+		/* return and clear dirty bits of ports [32 * w, 32 * w + 31] */
+		uint32_t take (uint32_t w) {
+			if (!__atomic_load_n (&_dirty[w], __ATOMIC_RELAXED)) {
+				return 0;
+			}
+			return __atomic_exchange_n (&_dirty[w], 0, __ATOMIC_ACQUIRE);
+		}
+
+		float value (uint32_t p) const {
+			uint32_t b = __atomic_load_n ((uint32_t*)&_val[p], __ATOMIC_RELAXED);
+			float v;
+			memcpy (&v, &b, sizeof (float));
+			return v;
+		}
+
+	private:
+		static uint32_t float_bits (float v) {
+			uint32_t b;
+			memcpy (&b, &v, sizeof (float));
+			return b;
+		}
+
+		float*    _val;
+		uint32_t* _dirty;
+		uint32_t  _n_words;
+};
+
+} /* namespace */
+
+#endif
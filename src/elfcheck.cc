@@ -0,0 +1,343 @@
+/*
+ *  Copyright (C) 2016 Robin Gareus <robin@gareus.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "elfcheck.h"
+
+#ifndef __ELF__
+
+int elf_check_symbol (const char*, const char*)
+{
+	return -1;
+}
+
+#else
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dlfcn.h>
+#include <elf.h>
+#include <link.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/* read-only view of a mapped ELF file, all accessors are bounds-checked */
+class ElfImage
+{
+	public:
+		ElfImage (const uint8_t* d, size_t s)
+			: _d (d)
+			, _size (s)
+			, _phdr (NULL)
+			, _phnum (0)
+		{}
+
+		template <typename T> const T* at (size_t off, size_t n = 1) const {
+			if (off > _size || n > (_size - off) / sizeof (T) || (off % __alignof__ (T))) {
+				return NULL;
+			}
+			return (const T*) (_d + off);
+		}
+
+		bool init () {
+			const ElfW(Ehdr)* eh = at<ElfW(Ehdr)> (0);
+			if (!eh || eh->e_phentsize != sizeof (ElfW(Phdr))) {
+				return false;
+			}
+			_phdr = at<ElfW(Phdr)> (eh->e_phoff, eh->e_phnum);
+			_phnum = eh->e_phnum;
+			return _phdr != NULL;
+		}
+
+		/* map a virtual address to a file-offset */
+		bool vaddr_to_offset (ElfW(Addr) addr, size_t* off) const {
+			for (uint32_t i = 0; i < _phnum; ++i) {
+				const ElfW(Phdr)* p = &_phdr[i];
+				if (p->p_type != PT_LOAD) {
+					continue;
+				}
+				if (addr >= p->p_vaddr && addr - p->p_vaddr < p->p_filesz) {
+					*off = addr - p->p_vaddr + p->p_offset;
+					return true;
+				}
+			}
+			return false;
+		}
+
+		const ElfW(Dyn)* dynamic (size_t* n) const {
+			for (uint32_t i = 0; i < _phnum; ++i) {
+				const ElfW(Phdr)* p = &_phdr[i];
+				if (p->p_type == PT_DYNAMIC) {
+					*n = p->p_filesz / sizeof (ElfW(Dyn));
+					return at<ElfW(Dyn)> (p->p_offset, *n);
+				}
+			}
+			return NULL;
+		}
+
+	private:
+		const uint8_t*    _d;
+		size_t            _size;
+		const ElfW(Phdr)* _phdr;
+		uint32_t          _phnum;
+};
+
+struct DynSyms {
+	size_t           sym_off;
+	const char*      str;
+	size_t           str_size;
+};
+
+static uint32_t gnu_hash (const char* s)
+{
+	uint32_t h = 5381;
+	for (; *s; ++s) {
+		h = (h << 5) + h + (uint8_t)*s;
+	}
+	return h;
+}
+
+static uint32_t sysv_hash (const char* s)
+{
+	uint32_t h = 0;
+	for (; *s; ++s) {
+		h = (h << 4) + (uint8_t)*s;
+		uint32_t g = h & 0xf0000000;
+		if (g) {
+			h ^= g >> 24;
+		}
+		h &= ~g;
+	}
+	return h;
+}
+
+/* 1: match, 0: no match, -1: out of bounds */
+static int sym_match (ElfImage const& elf, DynSyms const& ds, uint32_t idx, const char* symbol)
+{
+	const ElfW(Sym)* s = elf.at<ElfW(Sym)> (ds.sym_off + idx * sizeof (ElfW(Sym)));
+	if (!s) {
+		return -1;
+	}
+	size_t len = strlen (symbol) + 1;
+	if (s->st_name >= ds.str_size || len > ds.str_size - s->st_name) {
+		return 0;
+	}
+	if (memcmp (ds.str + s->st_name, symbol, len)) {
+		return 0;
+	}
+	if (s->st_shndx == SHN_UNDEF) {
+		return 0;
+	}
+	/* st_info is identical for ELF32 and ELF64 */
+	switch (ELF32_ST_BIND (s->st_info)) {
+		case STB_GLOBAL:
+		case STB_WEAK:
+			break;
+		default:
+			return 0;
+	}
+	switch (ELF32_ST_TYPE (s->st_info)) {
+		case STT_FUNC:
+#ifdef STT_GNU_IFUNC
+		case STT_GNU_IFUNC:
+#endif
+			break;
+		default:
+			return 0;
+	}
+	return 1;
+}
+
+static int lookup_gnu (ElfImage const& elf, DynSyms const& ds, size_t off, const char* symbol)
+{
+	const uint32_t* hdr = elf.at<uint32_t> (off, 4);
+	if (!hdr) {
+		return -1;
+	}
+	const uint32_t nbuckets    = hdr[0];
+	const uint32_t symoffset   = hdr[1];
+	const uint32_t bloom_size  = hdr[2];
+	const uint32_t bloom_shift = hdr[3];
+	const uint32_t bits = 8 * sizeof (ElfW(Addr));
+
+	if (nbuckets == 0 || bloom_size == 0) {
+		return 0;
+	}
+
+	off += 4 * sizeof (uint32_t);
+	const ElfW(Addr)* bloom = elf.at<ElfW(Addr)> (off, bloom_size);
+	off += bloom_size * sizeof (ElfW(Addr));
+	const uint32_t* buckets = elf.at<uint32_t> (off, nbuckets);
+	off += nbuckets * sizeof (uint32_t);
+	if (!bloom || !buckets) {
+		return -1;
+	}
+
+	const uint32_t h = gnu_hash (symbol);
+	const ElfW(Addr) word = bloom[(h / bits) % bloom_size];
+	const ElfW(Addr) mask = ((ElfW(Addr))1 << (h % bits)) | ((ElfW(Addr))1 << ((h >> bloom_shift) % bits));
+	if ((word & mask) != mask) {
+		return 0;
+	}
+
+	uint32_t idx = buckets[h % nbuckets];
+	if (idx < symoffset) {
+		return 0;
+	}
+
+	/* chain[] is indexed by (symbol-index - symoffset) */
+	for (;; ++idx) {
+		const uint32_t* h2 = elf.at<uint32_t> (off + (idx - symoffset) * sizeof (uint32_t));
+		if (!h2) {
+			return -1;
+		}
+		if ((h | 1) == (*h2 | 1)) {
+			int rv = sym_match (elf, ds, idx, symbol);
+			if (rv != 0) {
+				return rv;
+			}
+		}
+		if (*h2 & 1) {
+			break;
+		}
+	}
+	return 0;
+}
+
+static int lookup_sysv (ElfImage const& elf, DynSyms const& ds, size_t off, const char* symbol)
+{
+	const uint32_t* hdr = elf.at<uint32_t> (off, 2);
+	if (!hdr || hdr[0] == 0) {
+		return -1;
+	}
+	const uint32_t nbucket = hdr[0];
+	const uint32_t nchain  = hdr[1];
+	const uint32_t* bucket = elf.at<uint32_t> (off + 2 * sizeof (uint32_t), nbucket);
+	const uint32_t* chain  = elf.at<uint32_t> (off + (2 + nbucket) * sizeof (uint32_t), nchain);
+	if (!bucket || !chain) {
+		return -1;
+	}
+
+	uint32_t n = 0;
+	for (uint32_t idx = bucket[sysv_hash (symbol) % nbucket]; idx != STN_UNDEF; idx = chain[idx]) {
+		if (idx >= nchain || ++n > nchain) {
+			return -1;
+		}
+		int rv = sym_match (elf, ds, idx, symbol);
+		if (rv != 0) {
+			return rv;
+		}
+	}
+	return 0;
+}
+
+static int check_image (const uint8_t* data, size_t size, const char* symbol)
+{
+	ElfImage elf (data, size);
+
+	const ElfW(Ehdr)* eh = elf.at<ElfW(Ehdr)> (0);
+	if (!eh || memcmp (eh->e_ident, ELFMAG, SELFMAG)) {
+		return 0;
+	}
+
+	/* compare with lv2vst itself */
+	Dl_info info;
+	if (!dladdr ((void*)&elf_check_symbol, &info) || !info.dli_fbase) {
+		return -1;
+	}
+	const ElfW(Ehdr)* self = (const ElfW(Ehdr)*) info.dli_fbase;
+
+	if (eh->e_ident[EI_CLASS] != self->e_ident[EI_CLASS]
+			|| eh->e_ident[EI_DATA] != self->e_ident[EI_DATA]
+			|| eh->e_machine != self->e_machine) {
+		return 0;
+	}
+
+	if (eh->e_type != ET_DYN || !elf.init ()) {
+		return 0;
+	}
+
+	size_t n_dyn = 0;
+	const ElfW(Dyn)* dyn = elf.dynamic (&n_dyn);
+	if (!dyn) {
+		return 0;
+	}
+
+	ElfW(Addr) symtab = 0, strtab = 0, gnuhash = 0, hash = 0;
+	size_t strsz = 0;
+	for (size_t i = 0; i < n_dyn && dyn[i].d_tag != DT_NULL; ++i) {
+		switch (dyn[i].d_tag) {
+			case DT_SYMTAB:   symtab  = dyn[i].d_un.d_ptr; break;
+			case DT_STRTAB:   strtab  = dyn[i].d_un.d_ptr; break;
+			case DT_STRSZ:    strsz   = dyn[i].d_un.d_val; break;
+			case DT_HASH:     hash    = dyn[i].d_un.d_ptr; break;
+#ifdef DT_GNU_HASH
+			case DT_GNU_HASH: gnuhash = dyn[i].d_un.d_ptr; break;
+#endif
+			default: break;
+		}
+	}
+
+	DynSyms ds;
+	size_t str_off;
+	if (!symtab || !strtab
+			|| !elf.vaddr_to_offset (symtab, &ds.sym_off)
+			|| !elf.vaddr_to_offset (strtab, &str_off)
+			|| !(ds.str = elf.at<char> (str_off, strsz))) {
+		return -1;
+	}
+	ds.str_size = strsz;
+
+	size_t off;
+	if (gnuhash && elf.vaddr_to_offset (gnuhash, &off)) {
+		return lookup_gnu (elf, ds, off, symbol);
+	}
+	if (hash && elf.vaddr_to_offset (hash, &off)) {
+		return lookup_sysv (elf, ds, off, symbol);
+	}
+	return -1;
+}
+
+int elf_check_symbol (const char* lib_path, const char* symbol)
+{
+	int fd = open (lib_path, O_RDONLY);
+	if (fd < 0) {
+		return 0;
+	}
+
+	struct stat st;
+	if (fstat (fd, &st) || st.st_size < (off_t) sizeof (ElfW(Ehdr))) {
+		close (fd);
+		return 0;
+	}
+
+	void* data = mmap (NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close (fd);
+	if (data == MAP_FAILED) {
+		return -1;
+	}
+
+	int rv = check_image ((const uint8_t*)data, st.st_size, symbol);
+	munmap (data, st.st_size);
+	return rv;
+}
+
+#endif
@@ -0,0 +1,34 @@
+/*
+ *  Copyright (C) 2016 Robin Gareus <robin@gareus.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef _elfcheck_h_
+#define _elfcheck_h_
+
+/* Check if a shared object exports the given function, without loading it.
+ *
+ * The file is mapped and the symbol is looked up using the dynamic
+ * symbol table (DT_GNU_HASH or DT_HASH). The ELF class, byte-order and
+ * machine-type must match the one of lv2vst itself.
+ *
+ * returns  1 if the symbol is exported,
+ *          0 if the library cannot be used (not found, invalid, wrong arch),
+ *         -1 if the check is not available (non ELF platform, unsupported layout).
+ */
+int elf_check_symbol (const char* lib_path, const char* symbol);
+
+#endif
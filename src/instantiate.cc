@@ -34,6 +34,10 @@
 #include "loadlib.h"
 #include "lv2ttl.h"
 #include "lv2vst.h"
+#include "chain.h"
+#ifdef BRIDGE
+# include "bridge.h"
+#endif
 
 
 static void free_lines (char** ln) {
@@ -201,6 +205,18 @@ VstPlugin* instantiate_vst (audioMasterCallback audioMaster)
 	fn[1023] = 0;
 	bundles = load_file (fn);
 
+	/* .chain file: several plugins in series, one URI per line */
+	snprintf (fn, 1023, COMPOSE_FN, get_lib_path (), ".chain");
+	fn[1023] = 0;
+	char** chain = load_file (fn);
+	if (chain && chain[0]) {
+		VstPlugin* rv = instantiate_chain (audioMaster, chain, bundles);
+		free_lines (chain);
+		free_lines (bundles);
+		return rv;
+	}
+	free_lines (chain);
+
 	snprintf (fn, 1023, COMPOSE_FN, get_lib_path (), ".whitelist");
 	fn[1023] = 0;
 	whitelist = load_file (fn);
@@ -235,11 +251,16 @@ VstPlugin* instantiate_vst (audioMasterCallback audioMaster)
 
 	/* instantiate given plugin */
 
-	RtkLv2Description* plugin = get_desc_by_id (id, bundles);
+	RtkLv2Description* plugin = get_desc_by_id (id, bundles, true);
+#ifndef BRIDGE
 	free_lines (bundles);
+#endif
 	free_lines (whitelist);
 
 	if (!plugin) {
+#ifdef BRIDGE
+		free_lines (bundles);
+#endif
 		fprintf (stderr, "LV2Host: Failed to parse lv2 ttl.\n");
 		return NULL;
 	}
@@ -253,6 +274,18 @@ VstPlugin* instantiate_vst (audioMasterCallback audioMaster)
 	printf ("GUI-BDL: %s\n", plugin->bundle_path);
 #endif
 
+#ifdef BRIDGE
+	/* run the plugin in a helper process */
+	VstPlugin* rv = NULL;
+	try {
+		rv = new LV2VstBridge (audioMaster, plugin, bundles);
+	} catch (...) {
+		fprintf (stderr, "LV2Host: instantiation failed\n");
+		free_desc (plugin);
+	}
+	free_lines (bundles);
+	return rv;
+#else
 	try {
 		return new LV2Vst (audioMaster, plugin);
 	} catch (...) {
@@ -260,4 +293,5 @@ VstPlugin* instantiate_vst (audioMasterCallback audioMaster)
 		free_desc (plugin);
 	}
 	return NULL;
+#endif
 }
@@ -0,0 +1,98 @@
+/*
+ *  Copyright (C) 2016 Robin Gareus <robin@gareus.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "lv2ttl.h"
+
+/* parser independent helpers, also used with static descriptions */
+
+static uint32_t crc32_calc (const char* msg)
+{
+	size_t i = 0;
+	uint32_t crc = 0xFFFFFFFF;
+	while (msg[i]) {
+		uint8_t byte = (uint8_t)msg[i];
+		crc = crc ^ byte;
+		for (int j = 7; j >= 0; --j) {
+			uint32_t mask = -(crc & 1);
+			crc = (crc >> 1) ^ (0xEDB88320 & mask);
+		}
+		++i;
+	}
+#if 0
+	return ~crc;
+#else
+	/* well now, bitwig-studio barfs if any char is > 0x7f */
+	return (~crc & 0x7f7f7f7f);
+#endif
+}
+
+uint32_t uri_to_id (const char* plugin_uri)
+{
+	// TODO allow custom map
+	return crc32_calc (plugin_uri);
+}
+
+static char* strdup_null (const char* s)
+{
+	return s ? strdup (s) : NULL;
+}
+
+RtkLv2Description* dup_desc (RtkLv2Description const* desc)
+{
+	if (!desc) { return NULL; }
+	RtkLv2Description* d = (RtkLv2Description*) malloc (sizeof (RtkLv2Description));
+	memcpy (d, desc, sizeof (RtkLv2Description));
+	d->dsp_uri     = strdup_null (desc->dsp_uri);
+	d->gui_uri     = strdup_null (desc->gui_uri);
+	d->plugin_name = strdup_null (desc->plugin_name);
+	d->vendor      = strdup_null (desc->vendor);
+	d->bundle_path = strdup_null (desc->bundle_path);
+	d->dsp_path    = strdup_null (desc->dsp_path);
+	d->gui_path    = strdup_null (desc->gui_path);
+	d->ports = (struct LV2Port*) calloc (desc->nports_total, sizeof (struct LV2Port));
+	for (uint32_t i = 0; i < desc->nports_total; ++i) {
+		d->ports[i] = desc->ports[i];
+		d->ports[i].name   = strdup_null (desc->ports[i].name);
+		d->ports[i].symbol = strdup_null (desc->ports[i].symbol);
+		d->ports[i].doc    = strdup_null (desc->ports[i].doc);
+	}
+	return d;
+}
+
+void release_desc (RtkLv2Description* desc)
+{
+	if (!desc) { return; }
+	free (desc->dsp_uri);
+	free (desc->gui_uri);
+	free (desc->plugin_name);
+	free (desc->vendor);
+	free (desc->bundle_path);
+	free (desc->dsp_path);
+	free (desc->gui_path);
+	for (uint32_t i = 0; i < desc->nports_total; ++i) {
+		free (desc->ports[i].name);
+		free (desc->ports[i].symbol);
+		free (desc->ports[i].doc);
+	}
+	free (desc->ports);
+	free (desc);
+}
@@ -0,0 +1,89 @@
+/*
+ *  Copyright (C) 2016 Robin Gareus <robin@gareus.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/* lv2ttl.h API for STATIC_DESC builds, using descriptions which
+ * were generated from the bundles at build-time (see lv2ttl2c.cc) */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "loadlib.h"
+#include "lv2ttl.h"
+
+#include "lv2vst_static.h"
+
+uint32_t n_static_desc ()
+{
+	return sizeof (lv2_static_desc) / sizeof (RtkLv2Description);
+}
+
+RtkLv2Description const* static_desc (uint32_t i)
+{
+	if (i >= n_static_desc ()) {
+		return NULL;
+	}
+	return &lv2_static_desc[i];
+}
+
+/* paths are relative to the bundle-dir, which is the dir of lv2vst.so */
+static char* lib_relative_path (char* path)
+{
+	if (!path) {
+		return NULL;
+	}
+	size_t len = strlen (get_lib_path ()) + strlen (path) + 2;
+	char* rv = (char*) malloc (len);
+	snprintf (rv, len, "%s/%s", get_lib_path (), path);
+#ifdef _WIN32
+	for (char* c = rv; *c; ++c) {
+		if (*c == '/') {
+			*c = '\\';
+		}
+	}
+#endif
+	free (path);
+	return rv;
+}
+
+RtkLv2Description* get_desc_by_id (uint32_t id, char const* const*, bool)
+{
+	for (uint32_t i = 0; i < n_static_desc (); ++i) {
+		if (lv2_static_desc[i].id != id) {
+			continue;
+		}
+		RtkLv2Description* desc = dup_desc (&lv2_static_desc[i]);
+		desc->bundle_path = lib_relative_path (desc->bundle_path);
+		desc->dsp_path    = lib_relative_path (desc->dsp_path);
+		desc->gui_path    = lib_relative_path (desc->gui_path);
+		return desc;
+	}
+	return NULL;
+}
+
+RtkLv2Description* get_desc_by_uri (const char* uri, char const* const* bundles)
+{
+	return get_desc_by_id (uri_to_id (uri), bundles);
+}
+
+void free_desc (RtkLv2Description* desc)
+{
+	release_desc (desc);
+}
@@ -23,6 +23,7 @@
 #include <stdint.h>
 #include <string.h>
 #include <assert.h>
+#include <pthread.h>
 
 #ifdef _WIN32
 # include <windows.h>
@@ -46,8 +47,10 @@
 
 #include "lilv/lilv.h"
 
+#include "elfcheck.h"
 #include "loadlib.h"
 #include "lv2ttl.h"
+#include "scancache.h"
 
 #ifndef UINT32_MAX
 # define UINT32_MAX (4294967295U)
@@ -110,35 +113,17 @@ static enum PortType type_to_enum (int type, int direction)
 	return CONTROL_IN;
 }
 
-static uint32_t crc32_calc (const char* msg)
-{
-	size_t i = 0;
-	uint32_t crc = 0xFFFFFFFF;
-	while (msg[i]) {
-		uint8_t byte = (uint8_t)msg[i];
-		crc = crc ^ byte;
-		for (int j = 7; j >= 0; --j) {
-			uint32_t mask = -(crc & 1);
-			crc = (crc >> 1) ^ (0xEDB88320 & mask);
-		}
-		++i;
-	}
-#if 0
-	return ~crc;
-#else
-	/* well now, bitwig-studio barfs if any char is > 0x7f */
-	return (~crc & 0x7f7f7f7f);
-#endif
-}
-
 /* parser */
 
 class LV2Parser
 {
 	public:
 		LV2Parser (RtkLv2Description*, char const* const* bundles);
+		LV2Parser (RtkLv2Description*, LilvWorld* world);
 		~LV2Parser ();
 
+		static void load_world (LilvWorld*, char const* const* bundles);
+
 		int parse (const char* uri);
 
 		int parse (const uint32_t id) {
@@ -165,8 +150,11 @@ class LV2Parser
 			return "";
 		}
 
+		void init_nodes ();
+
 	private:
 		LilvWorld* world;
+		bool       own_world;
 		RtkLv2Description* desc;
 
 		LilvNode* uri_atom_supports;
@@ -194,10 +182,26 @@ class LV2Parser
 };
 
 LV2Parser::LV2Parser (RtkLv2Description* d, char const* const* bundles)
-	: desc (d)
+	: world (lilv_world_new ())
+	, own_world (true)
+	, desc (d)
+{
+	load_world (world, bundles);
+	init_nodes ();
+}
+
+/* use an already loaded world, owned by the caller */
+LV2Parser::LV2Parser (RtkLv2Description* d, LilvWorld* w)
+	: world (w)
+	, own_world (false)
+	, desc (d)
 {
-	world = lilv_world_new ();
+	init_nodes ();
+}
 
+void
+LV2Parser::load_world (LilvWorld* world, char const* const* bundles)
+{
 	// code-dup src/shell.h
 	unsigned int bndl_it = 0;
 	if (bundles) {
@@ -219,10 +223,17 @@ LV2Parser::LV2Parser (RtkLv2Description* d, char const* const* bundles)
 	}
 
 	if (bndl_it == 0) {
+		LilvNode* parallel = lilv_new_bool (world, true);
+		lilv_world_set_option (world, LILV_OPTION_PARALLEL_LOAD, parallel);
+		lilv_node_free (parallel);
 		lilv_world_load_all (world);
 	}
 	// end code-dup
+}
 
+void
+LV2Parser::init_nodes ()
+{
 	uri_atom_supports   = lilv_new_uri (world, LV2_ATOM__supports);
 	rsz_minimumSize     = lilv_new_uri (world, LV2_RESIZE_PORT__minimumSize);
 	uri_midi_event      = lilv_new_uri (world, LV2_MIDI__MidiEvent);
@@ -271,7 +282,9 @@ LV2Parser::~LV2Parser ()
 	lilv_node_free (lv2_requiredOption);
 	lilv_node_free (lv2_InputPort);
 	lilv_node_free (uri_rdf_type);
-	lilv_world_free (world);
+	if (own_world) {
+		lilv_world_free (world);
+	}
 }
 
 int LV2Parser::parse (const char* plugin_uri)
@@ -317,13 +330,24 @@ int LV2Parser::parse (const char* plugin_uri)
 	}
 	close (fd);
 #else
-	void* handle = open_lv2_lib (desc->dsp_path);
-	void* func = (void*) x_dlfunc (handle, "lv2_descriptor");
-	close_lv2_lib (handle);
-	if (!func) {
+# ifdef CHECK_ELF_ONLY
+	/* look up the symbol without loading the library, fall back to dlopen */
+	int elf_ok = elf_check_symbol (desc->dsp_path, "lv2_descriptor");
+	if (elf_ok == 0) {
 		fprintf (stderr, "Cannot open DSP: '%s' for '%s'\n", desc->dsp_path, plugin_uri);
 		return -1;
 	}
+	if (elf_ok < 0)
+# endif
+	{
+		void* handle = open_lv2_lib (desc->dsp_path);
+		void* func = (void*) x_dlfunc (handle, "lv2_descriptor");
+		close_lv2_lib (handle);
+		if (!func) {
+			fprintf (stderr, "Cannot open DSP: '%s' for '%s'\n", desc->dsp_path, plugin_uri);
+			return -1;
+		}
+	}
 #endif
 
 	LilvNodes* mv = lilv_plugin_get_value (p, lv2_minorVersion);
@@ -400,7 +424,9 @@ int LV2Parser::parse (const char* plugin_uri)
 	}
 
 	LilvUIs* uis = lilv_plugin_get_uis (p);
-#ifdef _WIN32
+#ifdef SUPPORTED_UI
+	static const char* suppored_ui = SUPPORTED_UI;
+#elif defined _WIN32
 	static const char* suppored_ui = LV2_UI__WindowsUI;
 #elif defined __APPLE__
 	static const char* suppored_ui = LV2_UI__CocoaUI;
@@ -440,10 +466,18 @@ int LV2Parser::parse (const char* plugin_uri)
 	}
 #else
 	if (desc->gui_path) {
-		handle = open_lv2_lib (desc->gui_path);
-		func = (void*) x_dlfunc (handle, "lv2ui_descriptor");
-		close_lv2_lib (handle);
-		if (!func) {
+		bool ok = false;
+# ifdef CHECK_ELF_ONLY
+		int elf_ok = elf_check_symbol (desc->gui_path, "lv2ui_descriptor");
+		ok = elf_ok > 0;
+		if (elf_ok < 0)
+# endif
+		{
+			void* handle = open_lv2_lib (desc->gui_path);
+			ok = NULL != x_dlfunc (handle, "lv2ui_descriptor");
+			close_lv2_lib (handle);
+		}
+		if (!ok) {
 			fprintf (stderr, "Cannot open GUI: '%s' for '%s'\n", desc->gui_path, plugin_uri);
 			free (desc->gui_uri);
 			free (desc->gui_path);
@@ -628,20 +662,127 @@ static int verify_support (RtkLv2Description* desc) {
 }
 
 /* ****************************************************************************
- * public API
+ * process-wide cache, shared by all plugin instances.
+ *
+ * The LilvWorld is loaded once on demand, and parsed descriptions are kept
+ * until the last one is released by free_desc(). All instances of a given
+ * lv2vst.so use the same bundle-list, which is not part of the cache-key.
  */
 
-uint32_t uri_to_id (const char* plugin_uri)
+struct SharedDesc {
+	RtkLv2Description* desc;
+	uint32_t           refs;
+};
+
+static pthread_mutex_t shared_lock  = PTHREAD_MUTEX_INITIALIZER;
+static LilvWorld*      shared_world = NULL;
+static SharedDesc*     shared_desc  = NULL;
+static uint32_t        shared_n     = 0;
+static uint32_t        shared_refs  = 0;
+
+/* all shared_* functions must be called with shared_lock held */
+static void shared_cache_clear ()
+{
+	for (uint32_t i = 0; i < shared_n; ++i) {
+		release_desc (shared_desc[i].desc);
+	}
+	free (shared_desc);
+	shared_desc = NULL;
+	shared_n = 0;
+	lilv_world_free (shared_world);
+	shared_world = NULL;
+}
+
+static RtkLv2Description* shared_cache_ref (uint32_t id)
+{
+	for (uint32_t i = 0; i < shared_n; ++i) {
+		if (shared_desc[i].desc->id == id) {
+			++shared_desc[i].refs;
+			++shared_refs;
+			return shared_desc[i].desc;
+		}
+	}
+	return NULL;
+}
+
+static bool shared_cache_unref (RtkLv2Description* desc)
 {
-	// TODO allow custom map
-	return crc32_calc (plugin_uri);
+	for (uint32_t i = 0; i < shared_n; ++i) {
+		if (shared_desc[i].desc != desc) {
+			continue;
+		}
+		assert (shared_desc[i].refs > 0 && shared_refs > 0);
+		--shared_desc[i].refs;
+		if (--shared_refs == 0) {
+			shared_cache_clear ();
+		}
+		return true;
+	}
+	return false;
 }
 
-RtkLv2Description* get_desc_by_id (uint32_t id, char const* const* bundles)
+RtkLv2Description* get_desc_by_id (uint32_t id, char const* const* bundles, bool use_scan_cache)
+{
+	pthread_mutex_lock (&shared_lock);
+	RtkLv2Description* desc = shared_cache_ref (id);
+	pthread_mutex_unlock (&shared_lock);
+
+	if (desc) {
+		return desc;
+	}
+
+	if (use_scan_cache) {
+		Lv2ScanCache cache (bundles);
+		desc = cache.get_desc (id);
+	}
+
+	pthread_mutex_lock (&shared_lock);
+
+	RtkLv2Description* other = shared_cache_ref (id);
+	if (other) {
+		/* added concurrently by another instance */
+		pthread_mutex_unlock (&shared_lock);
+		release_desc (desc);
+		return other;
+	}
+
+	if (!desc) {
+		if (!shared_world) {
+			shared_world = lilv_world_new ();
+			LV2Parser::load_world (shared_world, bundles);
+		}
+
+		desc = (RtkLv2Description*) calloc (1, sizeof (RtkLv2Description));
+		LV2Parser lp (desc, shared_world);
+		if (lp.parse (id) || verify_support (desc)) {
+			release_desc (desc);
+			desc = NULL;
+		}
+	}
+
+	if (!desc) {
+		if (shared_refs == 0) {
+			shared_cache_clear ();
+		}
+		pthread_mutex_unlock (&shared_lock);
+		return NULL;
+	}
+
+	shared_desc = (SharedDesc*) realloc (shared_desc, (shared_n + 1) * sizeof (SharedDesc));
+	shared_desc[shared_n].desc = desc;
+	shared_desc[shared_n].refs = 1;
+	++shared_n;
+	++shared_refs;
+
+	pthread_mutex_unlock (&shared_lock);
+	return desc;
+}
+
+RtkLv2Description* get_desc_from_world (LilvWorld* world, const char* uri)
 {
 	RtkLv2Description* desc = (RtkLv2Description*) calloc (1, sizeof (RtkLv2Description));
-	LV2Parser lp (desc, bundles);
-	if (lp.parse (id)) {
+	LV2Parser lp (desc, world);
+	if (lp.parse (uri)) {
 		free_desc (desc);
 		return NULL;
 	}
@@ -652,6 +793,72 @@ RtkLv2Description* get_desc_by_id (uint32_t id, char const* const* bundles)
 	return desc;
 }
 
+/* last path-component of the URI, used if there is no manifest-level name */
+static char* uri_to_name (const char* uri)
+{
+	size_t len = strlen (uri);
+	while (len > 1 && (uri[len - 1] == '/' || uri[len - 1] == '#')) {
+		--len;
+	}
+	size_t start = 0;
+	for (size_t i = 0; i + 1 < len; ++i) {
+		if (uri[i] == '/' || uri[i] == ':') {
+			start = i + 1;
+		}
+	}
+	char* name = (char*) malloc (len - start + 1);
+	memcpy (name, &uri[start], len - start);
+	name[len - start] = 0;
+	return name;
+}
+
+char* get_name_from_world (LilvWorld* world, const char* uri)
+{
+	LilvNode* p_uri      = lilv_new_uri (world, uri);
+	LilvNode* lv2_binary = lilv_new_uri (world, LV2_CORE__binary);
+	LilvNode* doap_name  = lilv_new_uri (world, LILV_NS_DOAP "name");
+
+	/* query the world directly, lilv_plugin_* would load the plugin's data files */
+	LilvNode* binary = lilv_world_get (world, p_uri, lv2_binary, NULL);
+	LilvNode* name   = lilv_world_get (world, p_uri, doap_name, NULL);
+
+	char* dsp_path = NULL;
+	if (binary && lilv_node_is_uri (binary)) {
+		dsp_path = lilv_file_uri_parse (lilv_node_as_uri (binary), NULL);
+	}
+
+	bool ok = false;
+	if (!dsp_path) {
+		fprintf (stderr, "Unsupported Plugin '%s' (no lv2:binary in manifest)\n", uri);
+	} else {
+#ifdef CHECK_ELF_ONLY
+		ok = elf_check_symbol (dsp_path, "lv2_descriptor") != 0;
+#else
+		int fd = open (dsp_path, 0);
+		if (fd >= 0) {
+			ok = true;
+			close (fd);
+		}
+#endif
+		if (!ok) {
+			fprintf (stderr, "Cannot open DSP: '%s' for '%s'\n", dsp_path, uri);
+		}
+	}
+
+	char* rv = NULL;
+	if (ok) {
+		rv = name ? strdup (lilv_node_as_string (name)) : uri_to_name (uri);
+	}
+
+	lilv_free (dsp_path);
+	lilv_node_free (name);
+	lilv_node_free (binary);
+	lilv_node_free (doap_name);
+	lilv_node_free (lv2_binary);
+	lilv_node_free (p_uri);
+	return rv;
+}
+
 RtkLv2Description* get_desc_by_uri (const char* uri, char const* const* bundles)
 {
 	RtkLv2Description* desc = (RtkLv2Description*) calloc (1, sizeof (RtkLv2Description));
@@ -670,20 +877,14 @@ RtkLv2Description* get_desc_by_uri (const char* uri, char const* const* bundles)
 void free_desc (RtkLv2Description* desc)
 {
 	if (!desc) { return; }
-	free (desc->dsp_uri);
-	free (desc->gui_uri);
-	free (desc->plugin_name);
-	free (desc->vendor);
-	free (desc->bundle_path);
-	free (desc->dsp_path);
-	free (desc->gui_path);
-	for (uint32_t i = 0; i < desc->nports_total; ++i) {
-		free (desc->ports[i].name);
-		free (desc->ports[i].symbol);
-		free (desc->ports[i].doc);
-	}
-	free (desc->ports);
-	free (desc);
+
+	pthread_mutex_lock (&shared_lock);
+	bool shared = shared_cache_unref (desc);
+	pthread_mutex_unlock (&shared_lock);
+
+	if (!shared) {
+		release_desc (desc);
+	}
 }
 
 #if 0 // unused
@@ -21,9 +21,28 @@
 
 #include "lv2desc.h"
 
-RtkLv2Description* get_desc_by_id (uint32_t id, char const* const* bundle);
+/* returned descriptions are shared by all instances in the process,
+ * they must not be modified and are released with free_desc() */
+RtkLv2Description* get_desc_by_id (uint32_t id, char const* const* bundle, bool use_scan_cache = false);
 RtkLv2Description* get_desc_by_uri (const char* uri, char const* const* bundle);
+
+#ifdef STATIC_DESC
+/* descriptions generated at build-time by lv2ttl2c */
+uint32_t n_static_desc ();
+RtkLv2Description const* static_desc (uint32_t i);
+#else
+/* parse using an already loaded world, the caller owns the description */
+typedef struct LilvWorldImpl LilvWorld;
+RtkLv2Description* get_desc_from_world (LilvWorld* world, const char* uri);
+
+/* manifest-level check only (lv2:binary, doap:name), without loading the
+ * plugin's data files. returns the plugin name (to be free()d) or NULL */
+char* get_name_from_world (LilvWorld* world, const char* uri);
+#endif
+
+RtkLv2Description* dup_desc (RtkLv2Description const* desc);
 void free_desc (RtkLv2Description* desc);
+void release_desc (RtkLv2Description* desc); ///< free a description, which is not shared
 uint32_t uri_to_id (const char* plugin_uri);
 
 #endif
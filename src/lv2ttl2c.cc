@@ -0,0 +1,225 @@
+/*
+ *  Copyright (C) 2016 Robin Gareus <robin@gareus.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/* Build-time tool: parse the BUNDLES, filter by WHITELIST and write
+ * the resulting plugin descriptions as C++ tables (see lv2static.cc).
+ *
+ * usage: lv2ttl2c <dir-containing-bundles> > lv2vst_static.h
+ */
+
+#include <limits.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "lilv/lilv.h"
+#include "lv2ttl.h"
+
+#if !(defined BUNDLES && defined WHITELIST)
+# error lv2ttl2c needs BUNDLES and WHITELIST
+#endif
+
+static const char* lv2bundles[] = {
+#include BUNDLES
+};
+
+static const char* lv2whitelist[] = {
+#include WHITELIST
+};
+
+static char bundle_dir[PATH_MAX];
+
+/* used by the parser, instead of loadlib.cc */
+const char* get_lib_path ()
+{
+	return bundle_dir;
+}
+
+static bool whitelisted (const char* uri)
+{
+	for (unsigned int i = 0; lv2whitelist[i]; ++i) {
+		size_t len = strlen (lv2whitelist[i]);
+		if (len > 0 && !strncmp (uri, lv2whitelist[i], len)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+static void emit_str (const char* s)
+{
+	if (!s) {
+		printf ("NULL");
+		return;
+	}
+	printf ("(char*)\"");
+	for (; *s; ++s) {
+		const unsigned char c = *s;
+		if (c == '"' || c == '\\') {
+			printf ("\\%c", c);
+		} else if (c < 0x20 || c > 0x7e) {
+			printf ("\\%03o", c);
+		} else {
+			putchar (c);
+		}
+	}
+	printf ("\"");
+}
+
+static void emit_float (float v)
+{
+	if (isnan (v)) {
+		printf ("NAN");
+	} else if (isinf (v)) {
+		printf (v < 0 ? "-INFINITY" : "INFINITY");
+	} else {
+		printf ("%.9ef", v);
+	}
+}
+
+/* paths relative to the bundle-dir, NULL if outside */
+static const char* relative_path (const char* path, bool* ok)
+{
+	if (!path) {
+		return NULL;
+	}
+	size_t len = strlen (bundle_dir);
+	if (strncmp (path, bundle_dir, len) || path[len] != '/') {
+		fprintf (stderr, "lv2ttl2c: '%s' is not inside '%s'\n", path, bundle_dir);
+		*ok = false;
+		return NULL;
+	}
+	return &path[len + 1];
+}
+
+static void emit_ports (RtkLv2Description const* d, uint32_t n)
+{
+	printf ("static struct LV2Port lv2_static_ports_%u[] = {\n", n);
+	for (uint32_t i = 0; i < d->nports_total; ++i) {
+		struct LV2Port const* p = &d->ports[i];
+		printf ("\t{ (PortType) %d, ", p->porttype);
+		emit_str (p->name); printf (", ");
+		emit_str (p->symbol); printf (", ");
+		emit_str (p->doc); printf (",\n\t  ");
+		emit_float (p->val_default); printf (", ");
+		emit_float (p->val_min); printf (", ");
+		emit_float (p->val_max); printf (", ");
+		emit_float (p->steps); printf (",\n\t  ");
+		printf ("%d, %d, %d, %d, %d, %d, %d },\n",
+				p->toggled, p->integer_step, p->logarithmic, p->sr_dependent,
+				p->enumeration, p->not_on_gui, p->not_automatic);
+	}
+	printf ("};\n\n");
+}
+
+/* fields in the same order as lv2desc.h */
+static void emit_desc (RtkLv2Description const* d, uint32_t n)
+{
+	bool ok = true;
+	printf ("\t{\n\t\t");
+	emit_str (d->dsp_uri); printf (",\n\t\t");
+	emit_str (d->gui_uri); printf (",\n\t\t");
+	printf ("0x%08x,\n\t\t", d->id);
+	emit_str (d->plugin_name); printf (",\n\t\t");
+	emit_str (d->vendor); printf (",\n\t\t");
+	emit_str (relative_path (d->bundle_path, &ok)); printf (",\n\t\t");
+	emit_str (relative_path (d->dsp_path, &ok)); printf (",\n\t\t");
+	emit_str (relative_path (d->gui_path, &ok)); printf (",\n\t\t");
+	printf ("%d, %d,\n\t\t", d->version_minor, d->version_micro);
+	printf ("lv2_static_ports_%u,\n\t\t", n);
+	printf ("%u, %u, %u, %u, %u, %u, %u, %u, %u, %u,\n\t\t",
+			d->nports_total, d->nports_audio_in, d->nports_audio_out,
+			d->nports_midi_in, d->nports_midi_out, d->nports_atom_in, d->nports_atom_out,
+			d->nports_ctrl, d->nports_ctrl_in, d->nports_ctrl_out);
+	printf ("%u, %uU, %uU,\n\t\t", d->min_atom_bufsiz, d->latency_ctrl_port, d->enable_ctrl_port);
+	printf ("%d, %d,\n\t\t", d->send_time_info, d->has_state_interface);
+	printf ("(PluginCategory) %d\n\t},\n", d->category);
+}
+
+int main (int argc, char** argv)
+{
+	if (argc != 2) {
+		fprintf (stderr, "usage: %s <bundle-dir>\n", argv[0]);
+		return 1;
+	}
+	if (!realpath (argv[1], bundle_dir)) {
+		fprintf (stderr, "lv2ttl2c: invalid bundle-dir '%s'\n", argv[1]);
+		return 1;
+	}
+
+	LilvWorld* world = lilv_world_new ();
+	for (unsigned int i = 0; lv2bundles[i]; ++i) {
+		char b_path[PATH_MAX + 1024];
+		snprintf (b_path, sizeof (b_path), "%s/%s/", bundle_dir, lv2bundles[i]);
+		LilvNode* node = lilv_new_file_uri (world, NULL, b_path);
+		lilv_world_load_bundle (world, node);
+		lilv_node_free (node);
+	}
+
+	RtkLv2Description** descs = NULL;
+	uint32_t n_descs = 0;
+
+	const LilvPlugins* all_plugins = lilv_world_get_all_plugins (world);
+	LILV_FOREACH(plugins, i, all_plugins) {
+		const LilvPlugin* p = lilv_plugins_get (all_plugins, i);
+		const char* uri = lilv_node_as_uri (lilv_plugin_get_uri (p));
+		if (!whitelisted (uri)) {
+			continue;
+		}
+		RtkLv2Description* desc = get_desc_from_world (world, uri);
+		if (!desc) {
+			continue;
+		}
+		bool ok = true;
+		relative_path (desc->bundle_path, &ok);
+		relative_path (desc->dsp_path, &ok);
+		relative_path (desc->gui_path, &ok);
+		if (!ok) {
+			free_desc (desc);
+			continue;
+		}
+		fprintf (stderr, "lv2ttl2c: %08x %s\n", desc->id, uri);
+		descs = (RtkLv2Description**) realloc (descs, (n_descs + 1) * sizeof (RtkLv2Description*));
+		descs[n_descs++] = desc;
+	}
+
+	int rv = 0;
+	if (n_descs == 0) {
+		fprintf (stderr, "lv2ttl2c: no supported plugins found\n");
+		rv = 1;
+	} else {
+		printf ("/* generated by lv2ttl2c, do not edit */\n\n");
+		for (uint32_t i = 0; i < n_descs; ++i) {
+			emit_ports (descs[i], i);
+		}
+		printf ("static const RtkLv2Description lv2_static_desc[] = {\n");
+		for (uint32_t i = 0; i < n_descs; ++i) {
+			emit_desc (descs[i], i);
+		}
+		printf ("};\n");
+	}
+
+	for (uint32_t i = 0; i < n_descs; ++i) {
+		free_desc (descs[i]);
+	}
+	free (descs);
+	lilv_world_free (world);
+	return rv;
+}
@@ -28,6 +28,34 @@
 # define UPDATE_FREQ_RATIO 60 // MAX # of audio-cycles per GUI-refresh
 #endif
 
+#ifndef MIDI_OUT_BATCH_SIZE
+# define MIDI_OUT_BATCH_SIZE 512 // max # of events per audioMasterProcessEvents call
+#endif
+
+#ifndef BYPASS_BUFFER_SIZE
+# define BYPASS_BUFFER_SIZE 16384 // per channel, max latency + block-size (power of two)
+#endif
+
+#ifndef BYPASS_FADE_MS
+# define BYPASS_FADE_MS 10 // crossfade duration when toggling bypass
+#endif
+
+#if defined PIPELINE || defined MULTI_MONO
+# include <sched.h>
+#endif
+
+#ifdef IDLE_SKIP
+# ifndef IDLE_SKIP_TAIL_MS
+#  define IDLE_SKIP_TAIL_MS 1000 // silence required before run() is skipped
+# endif
+# ifndef IDLE_SKIP_THRESHOLD
+#  define IDLE_SKIP_THRESHOLD 1e-6f // -120 dBFS
+# endif
+# ifdef __SSE__
+#  include <xmmintrin.h>
+# endif
+#endif
+
 static const size_t midi_buf_size = 8192;
 static const size_t vst_max_product_str_len = 64;
 
@@ -38,8 +66,30 @@ static const size_t vst_max_product_str_len = 64;
 #include "lv2ttl.h"
 #include "lv2vst.h"
 
-extern "C" {
-	char* lilv_dirname(const char* path);
+static bool is_dir_sep (const char c)
+{
+#ifdef _WIN32
+	return c == '/' || c == '\\';
+#else
+	return c == '/';
+#endif
+}
+
+/* same as lilv_dirname(), lilv is not available with STATIC_DESC */
+static char* dir_name (const char* path)
+{
+	const char* s = path + strlen (path) - 1;
+	for (; s > path && is_dir_sep (*s); --s) {}  // Last non-slash
+	for (; s > path && !is_dir_sep (*s); --s) {} // Last internal slash
+	for (; s > path && is_dir_sep (*s); --s) {}  // Skip duplicates
+
+	if (s == path) {
+		return strdup (is_dir_sep (*s) ? "/" : ".");
+	}
+	char* dirname = (char*) malloc (s - path + 2);
+	memcpy (dirname, path, s - path + 1);
+	dirname[s - path + 1] = '\0';
+	return dirname;
 }
 
 /* ****************************************************************************
@@ -58,25 +108,68 @@ static inline void strncpyn (char* dest, const char* src, size_t n)
 
 LV2Vst::LV2Vst (audioMasterCallback audioMaster, RtkLv2Description* desc)
 	: VstPlugin (audioMaster, desc->nports_ctrl_in)
-	, ctrl_to_ui (1 + UPDATE_FREQ_RATIO * desc->nports_ctrl)
+	, ctrl_to_ui (desc->nports_total)
 	, atom_to_ui (1 + UPDATE_FREQ_RATIO * desc->min_atom_bufsiz)
 	, atom_from_ui (UPDATE_FREQ_RATIO * desc->min_atom_bufsiz)
 	, _desc (desc)
 	, _plugin_dsp (0)
 	, _plugin_instance (0)
+#ifdef SHARED_URID_MAP
+	, _map (Lv2UriMap::shared ())
+#endif
 	, _ui (this)
 	, _worker (0)
 	, worker_iface (0)
 	, opts_iface (0)
 	, _portmap_atom_to_ui (UINT32_MAX)
 	, _portmap_atom_from_ui (UINT32_MAX)
-	, midi_buffer (midi_buf_size)
+	, _midi_in_dropped (0)
+	, _midi_in_dropped_bytes (0)
 	, _ui_sync (true)
 	, _active (false)
+	, _offline (false)
+	, _bypass (false)
+	, _bypass_gain (0)
+	, _bypass_buf (0)
+	, _bypass_wpos (0)
+#ifdef IDLE_SKIP
+	, _idle_wakeup (true)
+	, _idle_input_active (true)
+	, _idle_silent_samples (0)
+	, _idle_skipped_blocks (0)
+	, _idle_skipped_samples (0)
+#endif
+#ifdef OFFLINE_BLOCKSIZE
+	, _agg_active (false)
+	, _agg_block_size (0)
+	, _agg_pos (0)
+#endif
+#ifdef PIPELINE
+	, _ctrl_in (desc->nports_total)
+	, _pipe_active (false)
+	, _pipe_run (false)
+	, _pipe_busy (false)
+	, _pipe_sched (false)
+	, _pipe_latency (0)
+	, _pipe_n_samples (0)
+	, _pipe_in (0)
+	, _pipe_out (0)
+	, _pipe_fifo (0)
+#endif
 	, _compat_mode (Strict)
 {
-	_effect.numInputs = _desc->nports_audio_in;
-	_effect.numOutputs = _desc->nports_audio_out;
+	_n_mono = 1;
+#ifdef MULTI_MONO
+	/* expose mono plugins with MULTI_MONO channels */
+	if (_desc->nports_audio_in == 1 && _desc->nports_audio_out == 1) {
+		_n_mono = MULTI_MONO;
+	}
+#endif
+	_n_audio_in  = _n_mono * _desc->nports_audio_in;
+	_n_audio_out = _n_mono * _desc->nports_audio_out;
+
+	_effect.numInputs = _n_audio_in;
+	_effect.numOutputs = _n_audio_out;
 	_effect.uniqueID = desc->id;
 	_effect.flags |= effFlagsCanReplacing;
 	_effect.version = 100 * _desc->version_minor + _desc->version_micro;
@@ -100,12 +193,85 @@ LV2Vst::LV2Vst (audioMasterCallback audioMaster, RtkLv2Description* desc)
 	memset (&_ti, 0, sizeof (VstTimeInfo));
 
 	_ports = (float*) malloc (_desc->nports_total * sizeof (float));
-	_ports_pre = (float*) malloc (_desc->nports_total * sizeof (float));
+	_ports_pre = (float*) malloc (_desc->nports_ctrl_out * sizeof (float));
 	_portmap_ctrl  = (uint32_t*) malloc (_desc->nports_total * sizeof (uint32_t));
 	_portmap_rctrl = (uint32_t*) malloc (_desc->nports_ctrl_in * sizeof (uint32_t));
-
-	_atom_in = (LV2_Atom_Sequence*) malloc (_desc->min_atom_bufsiz + sizeof (uint8_t));
+	_portmap_ctrl_in   = (uint32_t*) malloc (_desc->nports_ctrl_in * sizeof (uint32_t));
+	_portmap_ctrl_out  = (uint32_t*) malloc (_desc->nports_ctrl_out * sizeof (uint32_t));
+	_portmap_audio_in  = (uint32_t*) malloc (_desc->nports_audio_in * sizeof (uint32_t));
+	_portmap_audio_out = (uint32_t*) malloc (_desc->nports_audio_out * sizeof (uint32_t));
+	_connected_audio_in  = (float**) malloc (_n_audio_in * sizeof (float*));
+	_connected_audio_out = (float**) malloc (_n_audio_out * sizeof (float*));
+
+	_atom_in_size = _desc->min_atom_bufsiz;
+	_atom_in = (LV2_Atom_Sequence*) malloc (_atom_in_size + sizeof (uint8_t));
 	_atom_out = (LV2_Atom_Sequence*) malloc (_desc->min_atom_bufsiz + sizeof (uint8_t));
+	_atom_out->atom.size = 0;
+
+	if (_desc->nports_midi_in > 0) {
+		_midi_in = (LV2_Atom_Sequence*) malloc (_atom_in_size + sizeof (uint8_t));
+		_midi_in->atom.type = 0;
+		_midi_in->body.unit = 0;
+		_midi_in->body.pad  = 0;
+		_midi_in_max = _atom_in_size / sizeof (LV2_Atom_Event);
+		_midi_in_idx = (uint32_t*) malloc (_midi_in_max * sizeof (uint32_t));
+		reset_midi_in ();
+	} else {
+		_midi_in = 0;
+		_midi_in_idx = 0;
+		_midi_in_max = 0;
+	}
+
+	if (_desc->nports_midi_out > 0) {
+		_events_out = (VstEvents*) malloc (sizeof (VstEvents) + (MIDI_OUT_BATCH_SIZE - 2) * sizeof (VstEvent*));
+		_events_out_buf = (VstOutEvent*) calloc (MIDI_OUT_BATCH_SIZE, sizeof (VstOutEvent));
+		for (uint32_t i = 0; i < MIDI_OUT_BATCH_SIZE; ++i) {
+			_events_out->events[i] = (VstEvent*) &_events_out_buf[i];
+		}
+		_events_out->numEvents = 0;
+		_events_out->reserved = 0;
+	} else {
+		_events_out = 0;
+		_events_out_buf = 0;
+	}
+
+#ifdef MULTI_MONO
+	_mono = (MonoInstance*) calloc (_n_mono, sizeof (MonoInstance));
+	for (uint32_t k = 1; k < _n_mono; ++k) {
+		_mono[k - 1].ports = (float*) calloc (_desc->nports_total, sizeof (float));
+		if (_desc->nports_atom_out > 0 || _desc->nports_midi_out > 0) {
+			_mono[k - 1].atom_out = (LV2_Atom_Sequence*) malloc (_desc->min_atom_bufsiz + sizeof (uint8_t));
+		}
+	}
+	_mono_pool = NULL;
+	_mono_job.work = &LV2Vst::mono_job;
+	_mono_job.arg = this;
+#endif
+
+	/* wrapper bypass for plugins without lv2:enabled port,
+	 * keep a copy of the input to delay it by the plugin's latency */
+	if (_desc->enable_ctrl_port == UINT32_MAX && _n_audio_in > 0) {
+		_bypass_buf = (float**) calloc (_n_audio_in, sizeof (float*));
+		for (uint32_t i = 0; i < _n_audio_in; ++i) {
+			_bypass_buf[i] = (float*) calloc (BYPASS_BUFFER_SIZE, sizeof (float));
+		}
+	}
+
+#ifdef OFFLINE_BLOCKSIZE
+	_agg_in  = (float**) calloc (_n_audio_in + 1, sizeof (float*));
+	_agg_out = (float**) calloc (_n_audio_out + 1, sizeof (float*));
+	for (uint32_t i = 0; i < _n_audio_in; ++i) {
+		_agg_in[i] = (float*) calloc (OFFLINE_BLOCKSIZE, sizeof (float));
+	}
+	for (uint32_t i = 0; i < _n_audio_out; ++i) {
+		_agg_out[i] = (float*) calloc (OFFLINE_BLOCKSIZE, sizeof (float));
+	}
+	if (_desc->nports_midi_out > 0) {
+		_agg_atom_out = (LV2_Atom_Sequence*) calloc (1, _desc->min_atom_bufsiz + sizeof (uint8_t));
+	} else {
+		_agg_atom_out = 0;
+	}
+#endif
 
 	/* prepare LV2 feature set */
 
@@ -141,6 +307,7 @@ void LV2Vst::init ()
 	_uri.bufsz_minBlockLength = _map.uri_to_id (LV2_BUF_SIZE__minBlockLength);
 	_uri.bufsz_maxBlockLength = _map.uri_to_id (LV2_BUF_SIZE__maxBlockLength);
 	_uri.bufsz_sequenceSize   = _map.uri_to_id (LV2_BUF_SIZE__sequenceSize);
+	_uri.bufsz_nominalBlockLength = _map.uri_to_id ("http://lv2plug.in/ns/ext/buf-size#nominalBlockLength");
 
 	/* options to pass to plugin */
 	const LV2_Options_Option options[] = {
@@ -149,7 +316,7 @@ void LV2Vst::init ()
 		{ LV2_OPTIONS_INSTANCE, 0, _uri.bufsz_minBlockLength,
 			sizeof(int32_t), _uri.atom_Int, &_block_size },
 		{ LV2_OPTIONS_INSTANCE, 0, _uri.bufsz_maxBlockLength,
-			sizeof(int32_t), _uri.atom_Int, &_block_size },
+			sizeof(int32_t), _uri.atom_Int, &_max_block_size },
 		{ LV2_OPTIONS_INSTANCE, 0, _uri.bufsz_sequenceSize,
 			sizeof(int32_t), _uri.atom_Int, &midi_buf_size },
 		{ LV2_OPTIONS_INSTANCE, 0, 0, 0, 0, NULL }
@@ -186,7 +353,8 @@ void LV2Vst::init ()
 	}
 	/* init plugin */
 	update_block_size ();
-	char* dirname = lilv_dirname (_desc->dsp_path);
+	update_max_block_size ();
+	char* dirname = dir_name (_desc->dsp_path);
 	_plugin_instance = _plugin_dsp->instantiate (_plugin_dsp, update_sample_rate (), dirname, features);
 	free (dirname);
 
@@ -197,6 +365,8 @@ void LV2Vst::init ()
 
 	/* connect ports */
 	uint32_t c_ctrl = 0;
+	uint32_t c_cin  = 0;
+	uint32_t c_cout = 0;
 	uint32_t c_ain  = 0;
 	uint32_t c_aout = 0;
 
@@ -205,10 +375,11 @@ void LV2Vst::init ()
 			case CONTROL_IN:
 				_ports[p] = _desc->ports[p].val_default;
 				_plugin_dsp->connect_port (_plugin_instance, p, &_ports[p]);
-				{
-					ParamVal pv (p, _ports[p]);
-					ctrl_to_ui.write (&pv, 1);
-				}
+				_portmap_ctrl_in[c_cin++] = p;
+				ctrl_to_ui.set (p, _ports[p]);
+#ifdef PIPELINE
+				_ctrl_in.set (p, _ports[p]);
+#endif
 				if (!_desc->ports[p].not_on_gui && !_desc->ports[p].not_automatic) {
 					_portmap_ctrl[p] = c_ctrl;
 					_portmap_rctrl[c_ctrl] = p;
@@ -219,6 +390,7 @@ void LV2Vst::init ()
 				break;
 			case CONTROL_OUT:
 				_plugin_dsp->connect_port (_plugin_instance, p, &_ports[p]);
+				_portmap_ctrl_out[c_cout++] = p;
 				break;
 			case MIDI_IN:
 			case ATOM_IN:
@@ -231,9 +403,13 @@ void LV2Vst::init ()
 				_plugin_dsp->connect_port (_plugin_instance, p, _atom_out);
 				break;
 			case AUDIO_IN:
+				_portmap_audio_in[c_ain] = p;
+				_connected_audio_in[c_ain] = NULL;
 				++c_ain;
 				break;
 			case AUDIO_OUT:
+				_portmap_audio_out[c_aout] = p;
+				_connected_audio_out[c_aout] = NULL;
 				++c_aout;
 				break;
 			default:
@@ -241,7 +417,63 @@ void LV2Vst::init ()
 		}
 	}
 
+#ifdef MULTI_MONO
+	for (uint32_t k = 1; k < _n_mono; ++k) {
+		MonoInstance& m = _mono[k - 1];
+		m.schedule.handle = NULL;
+		m.schedule.schedule_work = &Lv2Worker::lv2_worker_schedule;
+		const LV2_Feature mono_schedule_feature = { LV2_WORKER__schedule, &m.schedule };
+		const LV2_Feature* mono_features[] = {
+			&map_feature,
+			&unmap_feature,
+			&mono_schedule_feature,
+			&bounded_block_length_feature,
+			&options_feature,
+			NULL
+		};
+
+		char* dirname = dir_name (_desc->dsp_path);
+		m.handle = _plugin_dsp->instantiate (_plugin_dsp, _sample_rate, dirname, mono_features);
+		free (dirname);
+
+		if (!m.handle) {
+			fprintf (stderr, "LV2Host: failed to instantiate '%s' (channel %u).\n", _desc->dsp_uri, k + 1);
+			throw -3;
+		}
+
+		for (uint32_t p = 0; p < _desc->nports_total; ++p) {
+			switch (_desc->ports[p].porttype) {
+				case CONTROL_IN:
+					_plugin_dsp->connect_port (m.handle, p, &_ports[p]);
+					break;
+				case CONTROL_OUT:
+					_plugin_dsp->connect_port (m.handle, p, &m.ports[p]);
+					break;
+				case MIDI_IN:
+				case ATOM_IN:
+					_plugin_dsp->connect_port (m.handle, p, _atom_in);
+					break;
+				case MIDI_OUT:
+				case ATOM_OUT:
+					_plugin_dsp->connect_port (m.handle, p, m.atom_out);
+					break;
+				default:
+					break;
+			}
+		}
+	}
+#endif
+
+	for (uint32_t i = 0; i < _n_audio_in; ++i) {
+		_connected_audio_in[i] = NULL;
+	}
+	for (uint32_t i = 0; i < _n_audio_out; ++i) {
+		_connected_audio_out[i] = NULL;
+	}
+
 	_effect.numParams = c_ctrl;
+	assert (c_cin == _desc->nports_ctrl_in);
+	assert (c_cout == _desc->nports_ctrl_out);
 	assert (c_ain == _desc->nports_audio_in);
 	assert (c_aout == _desc->nports_audio_out);
 
@@ -269,8 +501,14 @@ void LV2Vst::init ()
 	}
 
 	if (worker_iface) {
-		_worker = new Lv2Worker (worker_iface, _plugin_instance);
+		_worker = new Lv2Worker (worker_iface, _plugin_instance, _desc->min_atom_bufsiz);
 		schedule.handle = _worker;
+#ifdef MULTI_MONO
+		for (uint32_t k = 1; k < _n_mono; ++k) {
+			_mono[k - 1].worker = new Lv2Worker (worker_iface, _mono[k - 1].handle, _desc->min_atom_bufsiz);
+			_mono[k - 1].schedule.handle = _mono[k - 1].worker;
+		}
+#endif
 	}
 }
 
@@ -280,6 +518,18 @@ void LV2Vst::deinit ()
 
 	suspend ();
 
+#ifdef MULTI_MONO
+	for (uint32_t k = 1; k < _n_mono; ++k) {
+		MonoInstance& m = _mono[k - 1];
+		delete m.worker;
+		m.worker = 0;
+		if (_plugin_dsp && m.handle && _plugin_dsp->cleanup) {
+			_plugin_dsp->cleanup (m.handle);
+		}
+		m.handle = 0;
+	}
+#endif
+
 	if (_plugin_dsp && _plugin_instance && _plugin_dsp->cleanup) {
 		_plugin_dsp->cleanup (_plugin_instance);
 	}
@@ -289,14 +539,57 @@ LV2Vst::~LV2Vst ()
 {
 	_editor = 0; // prevent delete in ~VstPlugin
 
+#ifdef PIPELINE
+	pipe_stop ();
+#endif
+#ifdef IDLE_SKIP
+	if (_idle_skipped_blocks > 0) {
+		fprintf (stderr, "LV2Host: '%s' skipped run() while idle: %llu cycles, %llu samples\n",
+				_desc->dsp_uri, (unsigned long long)_idle_skipped_blocks, (unsigned long long)_idle_skipped_samples);
+	}
+#endif
 	deinit ();
 
 	free (_portmap_ctrl);
 	free (_portmap_rctrl);
+	free (_portmap_ctrl_in);
+	free (_portmap_ctrl_out);
+	free (_portmap_audio_in);
+	free (_portmap_audio_out);
+	free (_connected_audio_in);
+	free (_connected_audio_out);
 	free (_ports);
 	free (_ports_pre);
 	free (_atom_in);
 	free (_atom_out);
+	free (_midi_in);
+	free (_midi_in_idx);
+	free (_events_out);
+	free (_events_out_buf);
+#ifdef MULTI_MONO
+	for (uint32_t k = 1; k < _n_mono; ++k) {
+		free (_mono[k - 1].ports);
+		free (_mono[k - 1].atom_out);
+	}
+	free (_mono);
+#endif
+	if (_bypass_buf) {
+		for (uint32_t i = 0; i < _n_audio_in; ++i) {
+			free (_bypass_buf[i]);
+		}
+		free (_bypass_buf);
+	}
+#ifdef OFFLINE_BLOCKSIZE
+	for (uint32_t i = 0; i < _n_audio_in; ++i) {
+		free (_agg_in[i]);
+	}
+	for (uint32_t i = 0; i < _n_audio_out; ++i) {
+		free (_agg_out[i]);
+	}
+	free (_agg_in);
+	free (_agg_out);
+	free (_agg_atom_out);
+#endif
 	free_desc (_desc);
 	close_lv2_lib (_lib_handle);
 }
@@ -319,7 +612,7 @@ int32_t LV2Vst::can_do (char* text)
 		return _desc->send_time_info ? 1 : 0;
 	}
 	if (!strcmp ("bypass", text)) {
-		return _desc->enable_ctrl_port != UINT32_MAX ? 1 : 0;
+		return 1;
 	}
 #ifdef __APPLE__
 	if (!strcmp ("hasCockosViewAsConfig", text)) {
@@ -460,16 +753,24 @@ bool LV2Vst::set_parameter (int32_t i, float v)
 	uint32_t p = _portmap_rctrl[i];
 	const float val = param_to_lv2 (p, v);
 
+#ifdef PIPELINE
+	/* the plugin may be running concurrently, apply with the next block */
+	if (_ctrl_in.value (p) == val) {
+		return false;
+	}
+	_ctrl_in.set (p, val);
+#else
 	if (_ports[p] == val) {
 		return false;
 	}
 
 	_ports[p] = val;
+#endif
+#ifdef IDLE_SKIP
+	__atomic_store_n (&_idle_wakeup, true, __ATOMIC_RELEASE);
+#endif
 	if (_ui.is_open ()) {
-		if (ctrl_to_ui.write_space () > 0) {
-			ParamVal pv (p, _ports[p]);
-			ctrl_to_ui.write (&pv, 1);
-		}
+		ctrl_to_ui.set (p, val);
 	}
 	return true;
 }
@@ -480,7 +781,11 @@ float LV2Vst::get_parameter (int32_t i)
 		return 0;
 	}
 	uint32_t p = _portmap_rctrl[i];
+#ifdef PIPELINE
+	return param_to_vst (p, _ctrl_in.value (p));
+#else
 	return param_to_vst (p, _ports[p]);
+#endif
 }
 
 void LV2Vst::get_parameter_name (int32_t i, char* label)
@@ -506,7 +811,11 @@ void LV2Vst::get_parameter_display (int32_t i, char* text)
 		return;
 	}
 
+#ifdef PIPELINE
+	float v = _ctrl_in.value (_portmap_rctrl[i]);
+#else
 	float v =  _ports[_portmap_rctrl[i]];
+#endif
 
 	if (l->sr_dependent) {
 		v *= _sample_rate;
@@ -578,7 +887,9 @@ bool LV2Vst::can_be_automated (int32_t i)
 int32_t LV2Vst::bypass_plugin (bool bypass)
 {
 	if (_desc->enable_ctrl_port == UINT32_MAX) {
-		return 0;
+		/* wrapper bypass, crossfade in process_block () */
+		__atomic_store_n (&_bypass, bypass, __ATOMIC_RELAXED);
+		return 1;
 	}
 	uint32_t vst_idx = portmap_ctrl (_desc->enable_ctrl_port);
 	set_parameter (vst_idx, bypass ? 0 : 1); // notify UI, set immediate
@@ -596,11 +907,40 @@ void LV2Vst::resume ()
 		return;
 	}
 	if (_plugin_dsp->activate) {
-		_plugin_dsp->activate (_plugin_instance);
+		for (uint32_t k = 0; k < _n_mono; ++k) {
+			_plugin_dsp->activate (instance (k));
+		}
 	}
 	if (_desc->nports_midi_in) {
+		reset_midi_in ();
 		audioMaster (&_effect, audioMasterWantMidi, 0, 0, 0, 0);
 	}
+#ifdef IDLE_SKIP
+	__atomic_store_n (&_idle_wakeup, true, __ATOMIC_RELEASE);
+	_idle_silent_samples = 0;
+#endif
+
+	/* offline rendering: run the worker synchronously, for reproducible results.
+	 * This is decided once per activation, before any processing thread runs */
+	_offline = get_process_level () == kVstProcessLevelOffline;
+	if (_worker) {
+		_worker->set_freewheeling (_offline);
+	}
+#ifdef MULTI_MONO
+	for (uint32_t k = 1; k < _n_mono; ++k) {
+		if (_mono[k - 1].worker) {
+			_mono[k - 1].worker->set_freewheeling (_offline);
+		}
+	}
+	mono_start ();
+#endif
+#ifdef PIPELINE
+	pipe_start ();
+#endif
+#ifdef OFFLINE_BLOCKSIZE
+	/* decided once per activation, so that the latency is constant */
+	set_aggregate (_offline);
+#endif
 	_active = true;
 }
 
@@ -609,10 +949,28 @@ void LV2Vst::suspend ()
 	if (!_active) {
 		return;
 	}
+#ifdef PIPELINE
+	pipe_stop ();
+#endif
+#ifdef OFFLINE_BLOCKSIZE
+	set_aggregate (false);
+#endif
+#ifdef MULTI_MONO
+	mono_stop ();
+#endif
 	if (_plugin_dsp->deactivate) {
-		_plugin_dsp->deactivate (_plugin_instance);
+		for (uint32_t k = 0; k < _n_mono; ++k) {
+			_plugin_dsp->deactivate (instance (k));
+		}
 	}
 	_active = false;
+
+	if (_midi_in_dropped > 0) {
+		fprintf (stderr, "LV2Host: '%s' dropped %u MIDI input events (%u bytes), buffer size: %d\n",
+				_desc->dsp_uri, _midi_in_dropped, _midi_in_dropped_bytes, _atom_in_size);
+		_midi_in_dropped = 0;
+		_midi_in_dropped_bytes = 0;
+	}
 }
 
 void LV2Vst::set_sample_rate (float rate)
@@ -628,61 +986,787 @@ void LV2Vst::set_block_size (int32_t bs)
 {
 	if (_block_size != bs) {
 		VstPlugin::set_block_size (bs);
-		if (opts_iface) {
-			LV2_Options_Option block_size_option = {
-				LV2_OPTIONS_INSTANCE, 0,
-				_map.uri_to_id ("http://lv2plug.in/ns/ext/buf-size#nominalBlockLength"),
-				sizeof(int32_t), _uri.atom_Int, (void*)&_block_size
-			};
-			opts_iface->set (_plugin_instance, &block_size_option);
-		}
+		update_max_block_size ();
+		set_nominal_block_size (_block_size);
+	}
+}
+
+void LV2Vst::set_nominal_block_size (int32_t bs)
+{
+	if (!opts_iface) {
+		return;
+	}
+	_nominal_block_size = bs;
+	LV2_Options_Option block_size_option[] = {
+		{ LV2_OPTIONS_INSTANCE, 0, _uri.bufsz_nominalBlockLength,
+			sizeof(int32_t), _uri.atom_Int, (void*)&_nominal_block_size },
+		{ LV2_OPTIONS_INSTANCE, 0, 0, 0, 0, NULL }
+	};
+	for (uint32_t k = 0; k < _n_mono; ++k) {
+		opts_iface->set (instance (k), block_size_option);
+	}
+}
+
+/* the plugin is told the max. block size at instantiation. With
+ * OFFLINE_BLOCKSIZE this includes the size used for offline rendering */
+void LV2Vst::update_max_block_size ()
+{
+	_max_block_size = _block_size;
+#ifdef OFFLINE_BLOCKSIZE
+	if (_max_block_size < OFFLINE_BLOCKSIZE) {
+		_max_block_size = OFFLINE_BLOCKSIZE;
 	}
+#endif
 }
 
 /* ****************************************************************************
  * Process Audio/Midi
  */
 
+/* MIDI events from the host are directly converted to LV2 Atom events and
+ * appended to a staging sequence. Hosts may call effProcessEvents more than
+ * once per cycle, in which case the events may not be in order; an index of
+ * event-offsets is kept to sort them when merging.
+ *
+ * The staging sequence is preallocated (min_atom_bufsiz, or enough for all
+ * host blocks of an aggregated offline block) and reset every cycle, it also
+ * serves as pool for SysEx data. Events that do not fit are dropped and
+ * counted.
+ */
 int32_t LV2Vst::process_events (VstEvents* events)
 {
+	if (_desc->nports_midi_in == 0) {
+		return 0;
+	}
+
 	for (int32_t i = 0; i < events->numEvents; ++i) {
 		VstMidiEvent* mev = (VstMidiEvent*) events->events[i];
+		if (mev->type == kVstSysExType) {
+			VstMidiSysExEvent* sev = (VstMidiSysExEvent*) events->events[i];
+			if (sev->dumpBytes <= 0 || !sev->sysexDump) {
+				continue;
+			}
+			LV2_Atom_Event* aev = stage_midi_in (sev->deltaFrames, sev->dumpBytes);
+			if (aev) {
+				memcpy (LV2_ATOM_BODY (&aev->body), sev->sysexDump, sev->dumpBytes);
+			}
+			continue;
+		}
 		if (mev->type != kVstMidiType) {
 			continue;
 		}
-		if (midi_buffer.write_space () > 0) {
-			midi_buffer.write (mev, 1);
+
+		uint32_t size = 3;
+		uint8_t status = mev->midiData[0];
+		if (status < 0xf0) {
+			status &= 0xf0;
+		}
+		switch (status) {
+			case 0xc0:  // program change
+			case 0xd0:  // chan pressure
+			case 0xf1:  // MTC QF
+			case 0xf3:  // song select
+				size = 2;
+				break;
+			case 0xf8: // MCLK tick
+			case 0xfa: // MCLK start
+			case 0xfb: // MCLK stop
+			case 0xfe: // active sensing
+			case 0xff: // reset
+				size = 1;
+				break;
+			default:
+				break;
+		}
+
+		LV2_Atom_Event* aev = stage_midi_in (mev->deltaFrames, size);
+		if (aev) {
+			memcpy (LV2_ATOM_BODY (&aev->body), mev->midiData, size);
 		}
 	}
 	return 0;
 }
 
-void LV2Vst::process (float** inputs, float** outputs, int32_t n_samples)
+LV2_Atom_Event* LV2Vst::stage_midi_in (int64_t frames, uint32_t size)
 {
-	int ins = 0;
-	int outs = 0;
+	const uint32_t padded_size = ((sizeof (LV2_Atom_Event) + size) +  7) & (~7);
+	const uint32_t offset = _midi_in->atom.size - sizeof (LV2_Atom_Sequence_Body);
 
-	/* re-connect audio buffers */
-	for (uint32_t p = 0; p < _desc->nports_total; ++p) {
-		switch (_desc->ports[p].porttype) {
-			case AUDIO_IN:
-				// check isInputConnected() in resume()
-				//memset (outputs[ins], 0, n_samples * sizeof (float)); // if not connected
-				_plugin_dsp->connect_port (_plugin_instance, p, inputs[ins++]);
-				break;
-			case AUDIO_OUT:
-				// check isOutputConnected() in resume()
-				//memset (outputs[outs], 0, n_samples * sizeof (float)); // if plugin is b0rked
-				_plugin_dsp->connect_port (_plugin_instance, p, outputs[outs++]);
-				break;
-			default:
-				break;
+	if (sizeof (LV2_Atom) + _midi_in->atom.size + padded_size > _atom_in_size || _midi_in_cnt == _midi_in_max) {
+		++_midi_in_dropped;
+		_midi_in_dropped_bytes += size;
+		return NULL;
+	}
+
+#ifdef OFFLINE_BLOCKSIZE
+	if (_agg_active) {
+		frames += _agg_pos;
+		if (frames >= _agg_block_size) {
+			frames = _agg_block_size - 1;
+		}
+	}
+#endif
+
+	if (_midi_in_cnt > 0 && frames < _midi_in_last) {
+		_midi_in_sorted = false;
+	}
+	_midi_in_last = frames;
+	_midi_in_idx[_midi_in_cnt++] = offset;
+
+	LV2_Atom_Event* aev = (LV2_Atom_Event*) ((uint8_t*) (&_midi_in->body + 1) + offset);
+	aev->time.frames = frames;
+	aev->body.size   = size;
+	aev->body.type   = _uri.midi_MidiEvent;
+	_midi_in->atom.size += padded_size;
+	return aev;
+}
+
+/* copy staged events to `dst`, in timestamp order, return bytes written */
+uint32_t LV2Vst::merge_midi_in (uint8_t* dst, uint32_t avail)
+{
+	const uint8_t* src = (const uint8_t*) (&_midi_in->body + 1);
+	uint32_t len = _midi_in->atom.size - sizeof (LV2_Atom_Sequence_Body);
+
+	if (_midi_in_sorted && len <= avail) {
+		/* common case, copy all at once */
+		memcpy (dst, src, len);
+	} else {
+		if (!_midi_in_sorted) {
+			/* stable insertion sort, events are usually in a few ordered runs */
+			for (uint32_t i = 1; i < _midi_in_cnt; ++i) {
+				const uint32_t off = _midi_in_idx[i];
+				const int64_t t = ((const LV2_Atom_Event*) (src + off))->time.frames;
+				uint32_t j = i;
+				while (j > 0 && ((const LV2_Atom_Event*) (src + _midi_in_idx[j - 1]))->time.frames > t) {
+					_midi_in_idx[j] = _midi_in_idx[j - 1];
+					--j;
+				}
+				_midi_in_idx[j] = off;
+			}
+		}
+		len = 0;
+		for (uint32_t i = 0; i < _midi_in_cnt; ++i) {
+			const LV2_Atom_Event* ev = (const LV2_Atom_Event*) (src + _midi_in_idx[i]);
+			const uint32_t padded_size = ((sizeof (LV2_Atom_Event) + ev->body.size) +  7) & (~7);
+			if (len + padded_size > avail) {
+				++_midi_in_dropped;
+				_midi_in_dropped_bytes += ev->body.size;
+				continue;
+			}
+			memcpy (dst + len, ev, padded_size);
+			len += padded_size;
+		}
+	}
+
+	_atom_in->atom.size += len;
+	reset_midi_in ();
+	return len;
+}
+
+void LV2Vst::reset_midi_in ()
+{
+	_midi_in->atom.size = sizeof (LV2_Atom_Sequence_Body);
+	_midi_in_cnt = 0;
+	_midi_in_sorted = true;
+}
+
+/* MIDI events from the plugin are collected in a preallocated VstEvents
+ * batch, and sent to the host once per cycle. The atom sequence is sorted,
+ * so events are in timestamp order. If the batch is full, it is sent early.
+ */
+LV2Vst::VstOutEvent* LV2Vst::next_event_out ()
+{
+	if (_events_out->numEvents == MIDI_OUT_BATCH_SIZE) {
+		flush_events_out ();
+	}
+	return &_events_out_buf[_events_out->numEvents++];
+}
+
+void LV2Vst::flush_events_out ()
+{
+	if (_events_out->numEvents > 0) {
+		send_events_to_host (_events_out);
+		_events_out->numEvents = 0;
+	}
+}
+
+/* queue MIDI events of the plugin's output sequence with
+ * start <= time < end, at time - start + offset */
+void LV2Vst::send_midi_out (LV2_Atom_Sequence const* seq, int64_t start, int64_t end, int32_t offset)
+{
+	LV2_Atom_Event const* ev = (LV2_Atom_Event const*)((&(seq)->body) + 1); // lv2_atom_sequence_begin
+	while ((const uint8_t*)ev < ((const uint8_t*) &(seq)->body + (seq)->atom.size)) {
+		const uint8_t* data = (const uint8_t*)(ev+1);
+		const bool in_range = ev->time.frames >= start && ev->time.frames < end;
+		if (in_range && ev->body.type == _uri.midi_MidiEvent && ev->body.size > 1 && data[0] == 0xf0) {
+			if (data[ev->body.size -1] == 0xf7) {
+				/* sysexDump points into `seq`, valid until the batch is flushed */
+				VstMidiSysExEvent& sev = next_event_out ()->sysex;
+				memset(&sev, 0, sizeof(VstMidiSysExEvent));
+				sev.type = kVstSysExType;
+				sev.byteSize = sizeof (VstMidiSysExEvent);
+				sev.deltaFrames = ev->time.frames - start + offset;
+				sev.dumpBytes = ev->body.size;
+				sev.sysexDump = (char*)data;
+			}
+		}
+		else if (in_range && ev->body.type == _uri.midi_MidiEvent && ev->body.size > 0 && ev->body.size < 4) {
+			VstMidiEvent& mev = next_event_out ()->midi;
+			memset (&mev, 0, sizeof (VstMidiEvent));
+			mev.type = kVstMidiType;
+			mev.byteSize = sizeof (VstMidiEvent);
+			mev.deltaFrames = ev->time.frames - start + offset;
+			memcpy (mev.midiData, data, ev->body.size * sizeof (uint8_t));
 		}
+
+		ev = (LV2_Atom_Event const*) /* lv2_atom_sequence_next() */
+			((const uint8_t*)ev + sizeof (LV2_Atom_Event) + ((ev->body.size + 7) & ~7));
+	}
+}
+
+void LV2Vst::process (float** inputs, float** outputs, int32_t n_samples)
+{
+#ifdef PIPELINE
+	if (_pipe_active) {
+		process_pipelined (inputs, outputs, n_samples);
+		return;
+	}
+#endif
+
+#ifdef OFFLINE_BLOCKSIZE
+	if (_agg_active) {
+		process_aggregated (inputs, outputs, n_samples);
+		return;
 	}
+#endif
 
 	/* Get transport position */
 	VstTimeInfo *ti = get_time_info (kVstPpqPosValid | kVstBarsValid | kVstTimeSigValid | kVstTempoValid);
 
+	process_block (inputs, outputs, n_samples, ti);
+
+	if (_desc->nports_midi_out && _atom_out->atom.size > sizeof (LV2_Atom)) {
+		send_midi_out (_atom_out, 0, INT64_MAX, 0);
+		flush_events_out ();
+	}
+}
+
+#ifdef OFFLINE_BLOCKSIZE
+/* Offline rendering: the host's blocks are collected and the plugin is run
+ * with blocks of _agg_block_size samples. This adds a latency of one
+ * block. Aggregation is enabled by resume () if the host reports offline
+ * processing at that point, and stays enabled until suspend (); the
+ * latency is hence constant while the plugin is active.
+ */
+void LV2Vst::set_aggregate (bool yn)
+{
+	if (yn == _agg_active) {
+		return;
+	}
+	if (yn) {
+#ifdef PIPELINE
+		if (_pipe_active) {
+			return;
+		}
+#endif
+		/* use a multiple of the host's block-size, to keep event timing simple */
+		int32_t bs = _block_size > 0 ? _block_size : 1;
+		_agg_block_size = bs * (OFFLINE_BLOCKSIZE / bs);
+		if (_agg_block_size <= _block_size || !_agg_in) {
+			return;
+		}
+		_agg_pos = 0;
+		for (uint32_t i = 0; i < _n_audio_out; ++i) {
+			memset (_agg_out[i], 0, _agg_block_size * sizeof (float));
+		}
+		/* MIDI of all host blocks is staged for one plugin block */
+		grow_atom_in (_desc->min_atom_bufsiz * (_agg_block_size / bs));
+		if (_agg_atom_out) {
+			_agg_atom_out->atom.size = 0;
+		}
+		_agg_active = true;
+		_effect.initialDelay += _agg_block_size;
+		set_nominal_block_size (_agg_block_size);
+	} else {
+		_agg_active = false;
+		_effect.initialDelay -= _agg_block_size;
+		set_nominal_block_size (_block_size);
+	}
+	io_changed ();
+}
+
+/* enlarge the Atom/MIDI input buffers, called while not processing */
+void LV2Vst::grow_atom_in (uint32_t size)
+{
+	if (size <= _atom_in_size) {
+		return;
+	}
+	_atom_in_size = size;
+	_atom_in = (LV2_Atom_Sequence*) realloc (_atom_in, _atom_in_size + sizeof (uint8_t));
+	if (_midi_in) {
+		_midi_in = (LV2_Atom_Sequence*) realloc (_midi_in, _atom_in_size + sizeof (uint8_t));
+		_midi_in_max = _atom_in_size / sizeof (LV2_Atom_Event);
+		_midi_in_idx = (uint32_t*) realloc (_midi_in_idx, _midi_in_max * sizeof (uint32_t));
+		reset_midi_in ();
+	}
+	if (_portmap_atom_from_ui != UINT32_MAX) {
+		for (uint32_t k = 0; k < _n_mono; ++k) {
+			_plugin_dsp->connect_port (instance (k), _portmap_atom_from_ui, _atom_in);
+		}
+	}
+}
+
+void LV2Vst::process_aggregated (float** inputs, float** outputs, int32_t n_samples)
+{
+	int32_t off = 0;
+	while (off < n_samples) {
+		if (_agg_pos == 0) {
+			VstTimeInfo *ti = get_time_info (kVstPpqPosValid | kVstBarsValid | kVstTimeSigValid | kVstTempoValid);
+			_agg_ti_valid = ti != NULL;
+			if (ti) {
+				memcpy (&_agg_ti, ti, sizeof (VstTimeInfo));
+				_agg_ti.samplePos += off;
+			}
+		}
+
+		int32_t n = _agg_block_size - _agg_pos;
+		if (n > n_samples - off) {
+			n = n_samples - off;
+		}
+
+		for (uint32_t i = 0; i < _n_audio_in; ++i) {
+			memcpy (&_agg_in[i][_agg_pos], &inputs[i][off], n * sizeof (float));
+		}
+		for (uint32_t i = 0; i < _n_audio_out; ++i) {
+			memcpy (&outputs[i][off], &_agg_out[i][_agg_pos], n * sizeof (float));
+		}
+		if (_agg_atom_out && _agg_atom_out->atom.size > sizeof (LV2_Atom_Sequence_Body)) {
+			send_midi_out (_agg_atom_out, _agg_pos, _agg_pos + n, off);
+		}
+
+		_agg_pos += n;
+		off += n;
+
+		if (_agg_pos == _agg_block_size) {
+			process_block (_agg_in, _agg_out, _agg_block_size, _agg_ti_valid ? &_agg_ti : NULL);
+			if (_agg_atom_out) {
+				if (_atom_out->atom.size > sizeof (LV2_Atom)) {
+					memcpy (_agg_atom_out, _atom_out, sizeof (LV2_Atom) + _atom_out->atom.size);
+				} else {
+					_agg_atom_out->atom.size = 0;
+				}
+			}
+			_agg_pos = 0;
+		}
+	}
+	if (_agg_atom_out) {
+		flush_events_out ();
+	}
+}
+#endif
+
+#ifdef MULTI_MONO
+/* Multi-mono: one plugin instance per channel. The instances are run in
+ * parallel by a process-wide pool of threads (one per CPU core), the
+ * calling thread participates and waits until all instances have been
+ * processed.
+ */
+void LV2Vst::mono_start ()
+{
+	if (_n_mono < 2 || _mono_pool) {
+		return;
+	}
+	_mono_pool = Lv2ParallelPool::acquire ();
+}
+
+void LV2Vst::mono_stop ()
+{
+	if (_mono_pool) {
+		Lv2ParallelPool::release ();
+		_mono_pool = NULL;
+	}
+}
+
+void LV2Vst::mono_job (void* data)
+{
+	LV2Vst* self = (LV2Vst*)data;
+	self->mono_work ();
+}
+
+void LV2Vst::run_instance (uint32_t k, int32_t n_samples)
+{
+	if (k == 0) {
+		_plugin_dsp->run (_plugin_instance, n_samples);
+		return;
+	}
+	MonoInstance& m = _mono[k - 1];
+	if (m.atom_out) {
+		m.atom_out->atom.type = 0;
+		m.atom_out->atom.size = _desc->min_atom_bufsiz;
+	}
+	_plugin_dsp->run (m.handle, n_samples);
+	if (m.worker) {
+		m.worker->emit_response ();
+		m.worker->end_run ();
+	}
+}
+
+/* process instances until all are taken, the last one to finish
+ * releases the caller of run_mono () */
+void LV2Vst::mono_work ()
+{
+	uint32_t k;
+	while ((k = __atomic_fetch_add (&_mono_next, 1, __ATOMIC_ACQ_REL)) < _n_mono) {
+		run_instance (k, _mono_n_samples);
+		if (__atomic_sub_fetch (&_mono_pending, 1, __ATOMIC_ACQ_REL) == 0) {
+			_mono_done.signal ();
+		}
+	}
+}
+
+void LV2Vst::run_mono (int32_t n_samples)
+{
+	_mono_n_samples = n_samples;
+	__atomic_store_n (&_mono_pending, _n_mono, __ATOMIC_RELAXED);
+	__atomic_store_n (&_mono_next, 0, __ATOMIC_RELEASE);
+
+	if (!_mono_pool || !_mono_pool->begin (&_mono_job, _n_mono - 1)) {
+		for (uint32_t k = 0; k < _n_mono; ++k) {
+			run_instance (k, n_samples);
+		}
+		return;
+	}
+
+	mono_work ();
+
+	/* barrier: wait for all instances */
+	_mono_done.wait ();
+	_mono_pool->end (&_mono_job);
+}
+#endif
+
+#ifdef PIPELINE
+/* Pipelined processing: the host's thread prepares a block and hands it
+ * to a dedicated thread which runs the plugin, while the host continues
+ * with the output of the previous block. This adds a latency of one block,
+ * which is reported to the host.
+ *
+ * Time-info, MIDI and parameter changes are collected by prepare_block ()
+ * in the host's thread, and apply to the same block as the audio.
+ */
+void LV2Vst::pipe_start ()
+{
+	if (_pipe_active || _block_size <= 0) {
+		return;
+	}
+	_pipe_latency = _block_size;
+	_pipe_busy = false;
+	_pipe_sched = false;
+
+	_pipe_in  = (float**) calloc (_n_audio_in + 1, sizeof (float*));
+	_pipe_out = (float**) calloc (_n_audio_out + 1, sizeof (float*));
+	_pipe_fifo = (Lv2VstUtil::RingBuffer<float>**) calloc (_n_audio_out + 1, sizeof (Lv2VstUtil::RingBuffer<float>*));
+	for (uint32_t i = 0; i < _n_audio_in; ++i) {
+		_pipe_in[i] = (float*) calloc (_pipe_latency, sizeof (float));
+	}
+	for (uint32_t i = 0; i < _n_audio_out; ++i) {
+		_pipe_out[i] = (float*) calloc (_pipe_latency, sizeof (float));
+		_pipe_fifo[i] = new Lv2VstUtil::RingBuffer<float> (2 * _pipe_latency + 1);
+		/* prefill with silence, the fifo always holds one block */
+		memset (_pipe_out[i], 0, _pipe_latency * sizeof (float));
+		_pipe_fifo[i]->write (_pipe_out[i], _pipe_latency);
+	}
+
+	_pipe_run = true;
+	if (pthread_create (&_pipe_thread, NULL, pipe_thread, this)) {
+		fprintf (stderr, "LV2Host: failed to create DSP thread, not pipelining.\n");
+		_pipe_run = false;
+		return;
+	}
+
+	_pipe_active = true;
+	_effect.initialDelay += _pipe_latency;
+	io_changed ();
+}
+
+void LV2Vst::pipe_stop ()
+{
+	if (_pipe_run) {
+		if (_pipe_busy) {
+			_pipe_done.wait ();
+			_pipe_busy = false;
+		}
+		__atomic_store_n (&_pipe_run, false, __ATOMIC_RELEASE);
+		_pipe_start.signal ();
+		pthread_join (_pipe_thread, NULL);
+	}
+	if (_pipe_active) {
+		_effect.initialDelay -= _pipe_latency;
+		io_changed ();
+	}
+	_pipe_active = false;
+
+	if (_pipe_in) {
+		for (uint32_t i = 0; i < _n_audio_in; ++i) {
+			free (_pipe_in[i]);
+		}
+		for (uint32_t i = 0; i < _n_audio_out; ++i) {
+			free (_pipe_out[i]);
+			delete _pipe_fifo[i];
+		}
+	}
+	free (_pipe_in);
+	free (_pipe_out);
+	free (_pipe_fifo);
+	_pipe_in = 0;
+	_pipe_out = 0;
+	_pipe_fifo = 0;
+}
+
+void* LV2Vst::pipe_thread (void* data)
+{
+	LV2Vst* self = (LV2Vst*)data;
+	while (1) {
+		self->_pipe_start.wait ();
+		if (!__atomic_load_n (&self->_pipe_run, __ATOMIC_ACQUIRE)) {
+			break;
+		}
+		const int32_t n_samples = self->_pipe_n_samples;
+		self->run_block (self->_pipe_out, n_samples);
+		for (uint32_t i = 0; i < self->_n_audio_out; ++i) {
+			self->_pipe_fifo[i]->write (self->_pipe_out[i], n_samples);
+		}
+		self->_pipe_done.signal ();
+	}
+	return NULL;
+}
+
+void LV2Vst::process_pipelined (float** inputs, float** outputs, int32_t n_samples)
+{
+	if (!_pipe_sched) {
+		/* run the plugin with the same priority as the host's process thread */
+		int policy;
+		struct sched_param param;
+		if (pthread_getschedparam (pthread_self (), &policy, &param) == 0) {
+			pthread_setschedparam (_pipe_thread, policy, &param);
+		}
+		_pipe_sched = true;
+	}
+
+	/* VST hosts must not exceed the block-size set before resume () */
+	if (n_samples > _pipe_latency) {
+		for (uint32_t i = 0; i < _n_audio_out; ++i) {
+			memset (&outputs[i][_pipe_latency], 0, (n_samples - _pipe_latency) * sizeof (float));
+		}
+		n_samples = _pipe_latency;
+	}
+
+	VstTimeInfo *ti = get_time_info (kVstPpqPosValid | kVstBarsValid | kVstTimeSigValid | kVstTempoValid);
+
+	/* wait for the previous block */
+	int32_t n_prev = 0;
+	if (_pipe_busy) {
+		_pipe_done.wait ();
+		_pipe_busy = false;
+		n_prev = _pipe_n_samples;
+	}
+
+	/* MIDI output of the previous block, delayed by the added latency */
+	if (n_prev > 0 && _desc->nports_midi_out && _atom_out->atom.size > sizeof (LV2_Atom)) {
+		send_midi_out (_atom_out, 0, INT64_MAX, _pipe_latency - n_prev);
+		flush_events_out ();
+	}
+
+	/* inputs and outputs may share buffers, copy the input first */
+	for (uint32_t i = 0; i < _n_audio_in; ++i) {
+		memcpy (_pipe_in[i], inputs[i], n_samples * sizeof (float));
+	}
+	for (uint32_t i = 0; i < _n_audio_out; ++i) {
+		_pipe_fifo[i]->read (outputs[i], n_samples);
+	}
+
+	if (prepare_block (_pipe_in, _pipe_out, n_samples, ti)) {
+		_pipe_n_samples = n_samples;
+		_pipe_busy = true;
+		_pipe_start.signal ();
+	} else {
+		/* plugin was not run, outputs are ready */
+		for (uint32_t i = 0; i < _n_audio_out; ++i) {
+			_pipe_fifo[i]->write (_pipe_out[i], n_samples);
+		}
+	}
+}
+#endif
+
+/* Wrapper bypass for plugins without lv2:enabled port.
+ * The input is delayed by the plugin's latency and crossfaded with the
+ * plugin's output. While fully bypassed run () is not called.
+ */
+void LV2Vst::bypass_feed (float** inputs, int32_t n_samples)
+{
+	const uint32_t mask = BYPASS_BUFFER_SIZE - 1;
+	uint32_t n = n_samples;
+	uint32_t off = 0;
+	if (n > BYPASS_BUFFER_SIZE) {
+		off = n - BYPASS_BUFFER_SIZE;
+		n = BYPASS_BUFFER_SIZE;
+	}
+	const uint32_t pos = (_bypass_wpos + off) & mask;
+	const uint32_t n0 = n < BYPASS_BUFFER_SIZE - pos ? n : BYPASS_BUFFER_SIZE - pos;
+	for (uint32_t i = 0; i < _n_audio_in; ++i) {
+		memcpy (&_bypass_buf[i][pos], &inputs[i][off], n0 * sizeof (float));
+		memcpy (_bypass_buf[i], &inputs[i][off + n0], (n - n0) * sizeof (float));
+	}
+	_bypass_wpos = (_bypass_wpos + n_samples) & mask;
+}
+
+/* mix delayed input into the output, ramping the gain towards the
+ * current bypass state. If `replace` is set, the output is overwritten */
+void LV2Vst::bypass_mix (float** outputs, int32_t n_samples, bool replace)
+{
+	const uint32_t mask = BYPASS_BUFFER_SIZE - 1;
+	const float target = __atomic_load_n (&_bypass, __ATOMIC_RELAXED) ? 1.f : 0.f;
+	const float step = 1000.f / (BYPASS_FADE_MS * _sample_rate);
+
+	int32_t delay = 0;
+	if (_desc->latency_ctrl_port != UINT32_MAX && _ports[_desc->latency_ctrl_port] > 0) {
+		delay = floorf (_ports[_desc->latency_ctrl_port]);
+	}
+	if (delay > BYPASS_BUFFER_SIZE - n_samples) {
+		delay = n_samples < BYPASS_BUFFER_SIZE ? BYPASS_BUFFER_SIZE - n_samples : 0;
+	}
+	const uint32_t rpos = _bypass_wpos - n_samples - delay;
+
+	float g = _bypass_gain;
+	for (uint32_t i = 0; i < _n_audio_out; ++i) {
+		float* out = outputs[i];
+		float const* dry = _bypass_buf ? _bypass_buf[i % _n_audio_in] : NULL;
+		g = _bypass_gain;
+		for (int32_t k = 0; k < n_samples; ++k) {
+			const float d = dry ? dry[(rpos + k) & mask] : 0.f;
+			if (replace) {
+				out[k] = d;
+			} else {
+				if (g != target) {
+					g += g < target ? step : -step;
+					g = g < 0.f ? 0.f : g > 1.f ? 1.f : g;
+				}
+				out[k] += g * (d - out[k]);
+			}
+		}
+	}
+	if (!replace) {
+		_bypass_gain = g;
+	}
+}
+
+#ifdef IDLE_SKIP
+static bool is_silent (const float* buf, int32_t n_samples)
+{
+	int32_t i = 0;
+	float peak = 0;
+#ifdef __SSE__
+	if (((uintptr_t)buf & 15) == 0) {
+		const __m128 sign = _mm_set1_ps (-0.f);
+		__m128 vpeak = _mm_setzero_ps ();
+		for (; i + 4 <= n_samples; i += 4) {
+			vpeak = _mm_max_ps (vpeak, _mm_andnot_ps (sign, _mm_load_ps (&buf[i])));
+		}
+		vpeak = _mm_max_ps (vpeak, _mm_movehl_ps (vpeak, vpeak));
+		vpeak = _mm_max_ss (vpeak, _mm_shuffle_ps (vpeak, vpeak, 1));
+		_mm_store_ss (&peak, vpeak);
+	}
+#endif
+	for (; i < n_samples; ++i) {
+		const float a = fabsf (buf[i]);
+		peak = a > peak ? a : peak;
+	}
+	return peak < IDLE_SKIP_THRESHOLD;
+}
+
+/* return true if run() can be skipped: inputs are silent, there are no
+ * events or parameter changes, and the output has been silent for
+ * IDLE_SKIP_TAIL_MS */
+bool LV2Vst::check_idle (float** inputs, int32_t n_samples, bool transport_changed)
+{
+	/* parameters may change concurrently, test and clear at once */
+	bool active = __atomic_exchange_n (&_idle_wakeup, false, __ATOMIC_ACQ_REL);
+	active = active || transport_changed;
+
+	active = active || (_midi_in && _midi_in_cnt > 0);
+	active = active || atom_from_ui.read_space () > 0;
+	active = active || (_worker && !_worker->idle ());
+
+	for (uint32_t i = 0; i < _n_audio_in && !active; ++i) {
+		active = !is_silent (inputs[i], n_samples);
+	}
+
+	_idle_input_active = active;
+	if (active) {
+		_idle_silent_samples = 0;
+		return false;
+	}
+	return _idle_silent_samples >= (int64_t) _sample_rate * IDLE_SKIP_TAIL_MS / 1000;
+}
+
+void LV2Vst::update_idle (float** outputs, int32_t n_samples)
+{
+	if (_idle_input_active) {
+		return;
+	}
+	for (uint32_t i = 0; i < _n_audio_out; ++i) {
+		if (!is_silent (outputs[i], n_samples)) {
+			_idle_silent_samples = 0;
+			return;
+		}
+	}
+	_idle_silent_samples += n_samples;
+}
+#endif
+
+void LV2Vst::process_block (float** inputs, float** outputs, int32_t n_samples, VstTimeInfo* ti)
+{
+	if (prepare_block (inputs, outputs, n_samples, ti)) {
+		run_block (outputs, n_samples);
+	}
+}
+
+/* connect buffers and prepare the plugin's input sequence.
+ * Uses the host's time-info, and is called in the host's process thread.
+ * Returns false if the plugin does not need to run (outputs are filled in).
+ */
+bool LV2Vst::prepare_block (float** inputs, float** outputs, int32_t n_samples, VstTimeInfo* ti)
+{
+#ifdef PIPELINE
+	/* apply parameter changes, aligned to the block */
+	for (uint32_t w = 0; w < _ctrl_in.n_words (); ++w) {
+		uint32_t bits = _ctrl_in.take (w);
+		while (bits) {
+			const uint32_t p = 32 * w + __builtin_ctz (bits);
+			bits &= bits - 1;
+			_ports[p] = _ctrl_in.value (p);
+		}
+	}
+#endif
+
+	/* re-connect audio buffers, if the host's buffers changed */
+	for (uint32_t i = 0; i < _n_audio_in; ++i) {
+		// check isInputConnected() in resume()
+		if (_connected_audio_in[i] != inputs[i]) {
+			const uint32_t c = i % _desc->nports_audio_in;
+			_connected_audio_in[i] = inputs[i];
+			_plugin_dsp->connect_port (instance (i / _desc->nports_audio_in), _portmap_audio_in[c], inputs[i]);
+		}
+	}
+	for (uint32_t i = 0; i < _n_audio_out; ++i) {
+		// check isOutputConnected() in resume()
+		if (_connected_audio_out[i] != outputs[i]) {
+			const uint32_t c = i % _desc->nports_audio_out;
+			_connected_audio_out[i] = outputs[i];
+			_plugin_dsp->connect_port (instance (i / _desc->nports_audio_out), _portmap_audio_out[c], outputs[i]);
+		}
+	}
+
 	const bool transport_changed = ti && (
 			   ti->flags              != _ti.flags
 			|| ti->samplePos          != _ti.samplePos
@@ -691,6 +1775,43 @@ void LV2Vst::process (float** inputs, float** outputs, int32_t n_samples)
 			|| ti->timeSigNumerator   != _ti.timeSigNumerator
 			);
 
+	/* bump expected time */
+	if (ti) {
+		memcpy (&_ti, ti, sizeof (VstTimeInfo));
+		if (ti->flags & kVstTransportPlaying) {
+			_ti.samplePos += n_samples;
+		}
+	}
+
+	/* wrapper bypass: once faded out, the plugin is not run */
+	const bool bypass = __atomic_load_n (&_bypass, __ATOMIC_RELAXED);
+	if (_bypass_buf) {
+		bypass_feed (inputs, n_samples);
+	}
+	if (bypass && _bypass_gain >= 1.f) {
+		bypass_mix (outputs, n_samples, true);
+		_atom_out->atom.size = 0;
+		if (_midi_in) {
+			reset_midi_in ();
+		}
+		return false;
+	}
+
+#ifdef IDLE_SKIP
+	if (check_idle (inputs, n_samples, transport_changed)) {
+		for (uint32_t i = 0; i < _n_audio_out; ++i) {
+			memset (outputs[i], 0, n_samples * sizeof (float));
+		}
+		_atom_out->atom.size = 0;
+		if (bypass || _bypass_gain > 0.f) {
+			bypass_mix (outputs, n_samples, false);
+		}
+		++_idle_skipped_blocks;
+		_idle_skipped_samples += n_samples;
+		return false;
+	}
+#endif
+
 	/* atom buffers */
 	if (_desc->nports_atom_in > 0 || _desc->nports_midi_in > 0) {
 		/* start Atom sequence */
@@ -742,7 +1863,7 @@ void LV2Vst::process (float** inputs, float** outputs, int32_t n_samples)
 			uint32_t size = lv2_pos->size;
 			uint32_t padded_size = ((sizeof (LV2_Atom_Event) + size) +  7) & (~7);
 
-			if (_desc->min_atom_bufsiz > padded_size) {
+			if (_atom_in_size > padded_size) {
 				LV2_Atom_Event *aev = (LV2_Atom_Event *)seq;
 				aev->time.frames = 0;
 				aev->body.size   = size;
@@ -753,62 +1874,31 @@ void LV2Vst::process (float** inputs, float** outputs, int32_t n_samples)
 			}
 		}
 
-		if (_ui.has_editor ()) {
-			while (atom_from_ui.read_space () > sizeof (LV2_Atom)) {
+		if (_ui.has_editor () && !_offline) {
+			Lv2VstUtil::RingBuffer<char>::rw_vector vec;
+			atom_from_ui.get_read_vector (&vec);
+			size_t avail = vec.len[0] + vec.len[1];
+			size_t off = 0;
+			while (avail - off > sizeof (LV2_Atom)) {
 				LV2_Atom a;
-				atom_from_ui.read ((char *) &a, sizeof (LV2_Atom));
+				atom_from_ui.vector_read (vec, off, (char *) &a, sizeof (LV2_Atom));
+				off += sizeof (LV2_Atom);
 				uint32_t padded_size = _atom_in->atom.size + a.size + sizeof (int64_t);
-				if (_desc->min_atom_bufsiz > padded_size) {
+				if (_atom_in_size > padded_size) {
 					memset (seq, 0, sizeof (int64_t)); // LV2_Atom_Event->time
 					seq += sizeof (int64_t);
-					atom_from_ui.read ((char *) seq, a.size);
+					atom_from_ui.vector_read (vec, off, (char *) seq, a.size);
 					seq += a.size;
 					_atom_in->atom.size += a.size + sizeof (int64_t);
 				}
+				off += a.size;
 			}
+			atom_from_ui.advance (off);
 		}
 
 		if (_desc->nports_midi_in > 0) {
-			/* inject midi events */
-			while (midi_buffer.read_space () > 0) {
-				VstMidiEvent mev;
-				if (1 != midi_buffer.read (&mev, 1)) {
-					continue;
-				}
-
-				uint32_t size = 3;
-				uint8_t status = (mev.midiData[0]) & 0xf0;
-				switch (status) {
-					case 0xc0:  // program change
-					case 0xd0:  // chan pressure
-					case 0xf1:  // MTC QF
-					case 0xf3:  // song select
-						size = 2;
-						break;
-					case 0xf8: // MCLK tick
-					case 0xfa: // MCLK start
-					case 0xfb: // MCLK stop
-					case 0xfe: // active sensing
-					case 0xff: // reset
-						size = 1;
-						break;
-					default:
-						break;
-				}
-
-
-				uint32_t padded_size = ((sizeof (LV2_Atom_Event) + size) +  7) & (~7);
-
-				if (_desc->min_atom_bufsiz > padded_size) {
-					LV2_Atom_Event *aev = (LV2_Atom_Event *)seq;
-					aev->time.frames = mev.deltaFrames;
-					aev->body.size   = size;
-					aev->body.type   = _uri.midi_MidiEvent;
-					memcpy (LV2_ATOM_BODY (&aev->body), mev.midiData, size);
-					_atom_in->atom.size += padded_size;
-					seq += padded_size;
-				}
-			}
+			/* merge events staged by process_events (), all other events are at time 0 */
+			seq += merge_midi_in (seq, _atom_in_size - sizeof (LV2_Atom) - _atom_in->atom.size);
 		}
 	}
 
@@ -817,50 +1907,78 @@ void LV2Vst::process (float** inputs, float** outputs, int32_t n_samples)
 		_atom_out->atom.size = _desc->min_atom_bufsiz;
 	}
 
-	/* make a backup copy, to see what is changed */
-	memcpy (_ports_pre, _ports, _desc->nports_total * sizeof (float));
+	/* make a backup copy of control outputs, to see what is changed */
+	for (uint32_t i = 0; i < _desc->nports_ctrl_out; ++i) {
+		_ports_pre[i] = _ports[_portmap_ctrl_out[i]];
+	}
+	return true;
+}
 
+/* run the plugin, does not use any host-callbacks */
+void LV2Vst::run_block (float** outputs, int32_t n_samples)
+{
+#ifdef MULTI_MONO
+	run_mono (n_samples);
+#else
 	_plugin_dsp->run (_plugin_instance, n_samples);
+#endif
+
+#ifdef IDLE_SKIP
+	update_idle (outputs, n_samples);
+#endif
+
+	if (__atomic_load_n (&_bypass, __ATOMIC_RELAXED) || _bypass_gain > 0.f) {
+		bypass_mix (outputs, n_samples, false);
+	}
 
 	/* handle worker emit response  - may amend Atom seq... */
 	if (_worker) {
 		_worker->emit_response ();
 	}
 
-	/* bump expected time */
-	if (ti) {
-		memcpy (&_ti, ti, sizeof (VstTimeInfo));
-		if (ti->flags & kVstTransportPlaying) {
-			_ti.samplePos += n_samples;
-		}
-	}
-
-	/* create port-events for changed values */
+	/* create port-events for changed values, no UI updates when rendering offline */
 
-	if (_ui.is_open ()) {
-		for (uint32_t p = 0; p < _desc->nports_total; ++p) {
-			if (_desc->ports[p].porttype == CONTROL_IN && _ui_sync) {
-				ParamVal pv (p, _ports[p]);
-				ctrl_to_ui.write (&pv, 1);
-				continue;
+	if (_ui.is_open () && !_offline) {
+		if (_ui_sync) {
+			for (uint32_t i = 0; i < _desc->nports_ctrl_in; ++i) {
+				const uint32_t p = _portmap_ctrl_in[i];
+				ctrl_to_ui.set (p, _ports[p]);
 			}
-			if (_desc->ports[p].porttype != CONTROL_OUT) {
-				continue;
+		}
+
+		/* compare 32 outputs at a time without branches, then only visit changed ones */
+		for (uint32_t i0 = 0; i0 < _desc->nports_ctrl_out; i0 += 32) {
+			const uint32_t n = _desc->nports_ctrl_out - i0 < 32 ? _desc->nports_ctrl_out - i0 : 32;
+			uint32_t changed = 0;
+			for (uint32_t b = 0; b < n; ++b) {
+				changed |= (uint32_t)(_ports_pre[i0 + b] != _ports[_portmap_ctrl_out[i0 + b]]) << b;
 			}
-			if (_ports_pre[p] == _ports[p] && !_ui_sync) {
-				continue;
+			if (_ui_sync) {
+				changed = n < 32 ? (1U << n) - 1 : ~0U;
 			}
 
-			if (p == _desc->latency_ctrl_port) {
-				_effect.initialDelay =  (floor (_ports_pre[p]));
-				//io_changed ();
-			}
+			while (changed) {
+				const uint32_t i = i0 + __builtin_ctz (changed);
+				const uint32_t p = _portmap_ctrl_out[i];
+				changed &= changed - 1;
 
-			if (ctrl_to_ui.write_space () < 1) {
-				continue;
+				if (p == _desc->latency_ctrl_port) {
+					_effect.initialDelay =  (floor (_ports_pre[i]));
+#ifdef PIPELINE
+					if (_pipe_active) {
+						_effect.initialDelay += _pipe_latency;
+					}
+#endif
+#ifdef OFFLINE_BLOCKSIZE
+					if (_agg_active) {
+						_effect.initialDelay += _agg_block_size;
+					}
+#endif
+					//io_changed ();
+				}
+
+				ctrl_to_ui.set (p, _ports[p]);
 			}
-			ParamVal pv (p, _ports[p]);
-			ctrl_to_ui.write (&pv, 1);
 		}
 		_ui_sync = false;
 	} else {
@@ -869,47 +1987,15 @@ void LV2Vst::process (float** inputs, float** outputs, int32_t n_samples)
 
 	/* Atom sequence port-events */
 	if (_desc->nports_atom_out + _desc->nports_midi_out > 0 && _atom_out->atom.size > sizeof (LV2_Atom)) {
-		if (_ui.is_open () && atom_to_ui.write_space () >= _atom_out->atom.size + 2 * sizeof (LV2_Atom)) {
+		if (_ui.is_open () && !_offline && atom_to_ui.write_space () >= _atom_out->atom.size + 2 * sizeof (LV2_Atom)) {
 			LV2_Atom a = {_atom_out->atom.size + (uint32_t) sizeof (LV2_Atom), 0};
 
-			atom_to_ui.write ((char *) &a, sizeof (LV2_Atom));
-			atom_to_ui.write ((char *) _atom_out, a.size);
-		}
-
-		if (_desc->nports_midi_out) {
-			LV2_Atom_Event const* ev = (LV2_Atom_Event const*)((&(_atom_out)->body) + 1); // lv2_atom_sequence_begin
-			while ((const uint8_t*)ev < ((const uint8_t*) &(_atom_out)->body + (_atom_out)->atom.size)) {
-				if (ev->body.type == _uri.midi_MidiEvent && ev->body.size < 4) {
-					VstEvents vev;
-					vev.numEvents = 1;
-					VstMidiEvent mev;
-					vev.events[0] = (VstEvent*) &mev;
-					mev.type = kVstMidiType;
-					mev.byteSize = sizeof (VstMidiEvent);
-					mev.deltaFrames = ev->time.frames;
-					memcpy (mev.midiData, (const uint8_t*)(ev+1), ev->body.size * sizeof (uint8_t));
-					send_events_to_host (&vev);
-				}
-				else if (ev->body.type == _uri.midi_MidiEvent && ev->body.size > 4) {
-					const uint8_t* data = (const uint8_t*)(ev+1);
-					if (data[0] == 0xf0 && data[1] == 0x7f && data[ev->body.size -1] == 0xf7) {
-						VstEvents vev;
-						vev.numEvents = 1;
-						VstMidiSysExEvent sev;
-						memset(&sev, 0, sizeof(VstMidiSysExEvent));
-						vev.events[0] = (VstEvent*) &sev;
-						sev.type = kVstSysExType;
-						sev.byteSize = sizeof (VstMidiSysExEvent);
-						sev.deltaFrames = ev->time.frames;
-						sev.dumpBytes = ev->body.size;
-						sev.sysexDump = (char*)data;
-						send_events_to_host (&vev);
-					}
-				}
-
-				ev = (LV2_Atom_Event const*) /* lv2_atom_sequence_next() */
-					((const uint8_t*)ev + sizeof (LV2_Atom_Event) + ((ev->body.size + 7) & ~7));
-			}
+			/* header and sequence are published at once */
+			Lv2VstUtil::RingBuffer<char>::rw_vector vec;
+			atom_to_ui.get_write_vector (&vec);
+			atom_to_ui.vector_write (vec, 0, (char *) &a, sizeof (LV2_Atom));
+			atom_to_ui.vector_write (vec, sizeof (LV2_Atom), (char *) _atom_out, a.size);
+			atom_to_ui.commit (sizeof (LV2_Atom) + a.size);
 		}
 	}
 
@@ -35,8 +35,15 @@
 #include "lv2/lv2plug.in/ns/ext/instance-access/instance-access.h"
 
 #include "lv2desc.h"
+#include "dirtyvalues.h"
+#ifdef MULTI_MONO
+# include "parallelpool.h"
+#endif
 #include "ringbuffer.h"
 #include "uri_map.h"
+#if defined PIPELINE || defined MULTI_MONO
+# include "rtsemaphore.h"
+#endif
 #include "vst.h"
 #include "worker.h"
 
@@ -61,6 +68,7 @@ struct URIs {
 	LV2_URID bufsz_minBlockLength;
 	LV2_URID bufsz_maxBlockLength;
 	LV2_URID bufsz_sequenceSize;
+	LV2_URID bufsz_nominalBlockLength;
 };
 
 class LV2Vst;
@@ -155,6 +163,14 @@ class LV2Vst : public VstPlugin
 		virtual int32_t process_events (VstEvents* events);
 
 		LV2_Handle plugin_instance () const { return _plugin_instance; }
+		LV2_Handle instance (uint32_t k) const {
+#ifdef MULTI_MONO
+			if (k > 0) {
+				return _mono[k - 1].handle;
+			}
+#endif
+			return _plugin_instance;
+		}
 		LV2_Descriptor const* plugin_dsp () const { return _plugin_dsp; }
 		RtkLv2Description const* desc () const { return _desc; }
 		const char* bundle_path () const { return _desc->bundle_path; }
@@ -162,17 +178,13 @@ class LV2Vst : public VstPlugin
 		uint32_t portmap_atom_to_ui () const { return _portmap_atom_to_ui; }
 		uint32_t portmap_ctrl (uint32_t i) const { return _portmap_ctrl[i]; }
 
-		struct ParamVal {
-			ParamVal () : p (0) , v (0) {}
-			ParamVal (uint32_t pp, float vv) : p (pp), v (vv) {}
-			uint32_t p;
-			float    v;
-		};
+		/* max length of parameter names, depends on the host */
+		uint32_t param_name_len () const { return _compat_mode == Juicy ? 256 : 8; }
 
 		float param_to_vst (uint32_t index, float) const;
 		float param_to_lv2 (uint32_t index, float) const;
 
-		Lv2VstUtil::RingBuffer<struct ParamVal> ctrl_to_ui;
+		Lv2VstUtil::DirtyValues ctrl_to_ui;
 		Lv2VstUtil::RingBuffer<char> atom_to_ui;
 		Lv2VstUtil::RingBuffer<char> atom_from_ui;
 
@@ -203,6 +215,11 @@ class LV2Vst : public VstPlugin
 
 	protected:
 		void init ();
+		void process_block (float** inputs, float** outputs, int32_t n_samples, VstTimeInfo* ti);
+		bool prepare_block (float** inputs, float** outputs, int32_t n_samples, VstTimeInfo* ti);
+		void run_block (float** outputs, int32_t n_samples);
+		void set_nominal_block_size (int32_t bs);
+		void update_max_block_size ();
 		void deinit ();
 
 		size_t serialize_state (LV2State* state, void** data);
@@ -214,7 +231,11 @@ class LV2Vst : public VstPlugin
 		const LV2_Descriptor*  _plugin_dsp;
 		LV2_Handle             _plugin_instance;
 
+#ifdef SHARED_URID_MAP
+		Lv2UriMap& _map;
+#else
 		Lv2UriMap  _map;
+#endif
 		Lv2VstUI   _ui;
 		Lv2Worker* _worker;
 		URIs       _uri;
@@ -231,17 +252,147 @@ class LV2Vst : public VstPlugin
 		uint32_t* _portmap_rctrl;
 
 		LV2_Atom_Sequence* _atom_in;
+		uint32_t _atom_in_size; ///< capacity of _atom_in and _midi_in
 		LV2_Atom_Sequence* _atom_out;
 		uint32_t _portmap_atom_to_ui;
 		uint32_t _portmap_atom_from_ui;
 
 		float* _ports;
-		float* _ports_pre;
+		float* _ports_pre; ///< control output values before run(), by _portmap_ctrl_out
+
+		/* compact port-index tables, set up in init() */
+		uint32_t* _portmap_ctrl_in;
+		uint32_t* _portmap_ctrl_out;
+		uint32_t* _portmap_audio_in;
+		uint32_t* _portmap_audio_out;
+
+		/* host buffers last passed to connect_port () */
+		float** _connected_audio_in;
+		float** _connected_audio_out;
+
+		/* MIDI input, staged by process_events() */
+		LV2_Atom_Event* stage_midi_in (int64_t frames, uint32_t size);
+		uint32_t merge_midi_in (uint8_t* dst, uint32_t avail);
+		void reset_midi_in ();
+
+		LV2_Atom_Sequence* _midi_in;
+		uint32_t*          _midi_in_idx; ///< byte-offset of each staged event
+		uint32_t           _midi_in_cnt;
+		uint32_t           _midi_in_max;
+		int64_t            _midi_in_last;
+		bool               _midi_in_sorted;
+		uint32_t           _midi_in_dropped;       ///< events that did not fit
+		uint32_t           _midi_in_dropped_bytes; ///< their payload size
+
+		/* MIDI output, batched per process cycle */
+		union VstOutEvent {
+			VstMidiEvent      midi;
+			VstMidiSysExEvent sysex;
+		};
 
-		Lv2VstUtil::RingBuffer<VstMidiEvent> midi_buffer;
+		VstOutEvent* next_event_out ();
+		void flush_events_out ();
+		void send_midi_out (LV2_Atom_Sequence const* seq, int64_t start, int64_t end, int32_t offset);
+
+		VstEvents*   _events_out;
+		VstOutEvent* _events_out_buf;
 
 		bool _ui_sync;
 		bool _active;
+		bool _offline; ///< host reported kVstProcessLevelOffline on resume ()
+
+		/* wrapper bypass, if the plugin has no lv2:enabled port */
+		void bypass_feed (float** inputs, int32_t n_samples);
+		void bypass_mix (float** outputs, int32_t n_samples, bool replace);
+
+		bool     _bypass;      ///< set by host (effSetBypass)
+		float    _bypass_gain; ///< 0: plugin output, 1: bypassed
+		float**  _bypass_buf;  ///< delayed input, per channel
+		uint32_t _bypass_wpos;
+
+#ifdef IDLE_SKIP
+		bool check_idle (float** inputs, int32_t n_samples, bool transport_changed);
+		void update_idle (float** outputs, int32_t n_samples);
+
+		bool     _idle_wakeup;         ///< parameter changed since last cycle (atomic)
+		bool     _idle_input_active;   ///< non-silent input or events in this cycle
+		int64_t  _idle_silent_samples; ///< consecutive silent samples in/out
+		uint64_t _idle_skipped_blocks;  ///< cycles for which run() was skipped,
+		uint64_t _idle_skipped_samples; ///< printed when the plugin is unloaded
+#endif
+
+		int32_t _max_block_size;     ///< LV2_BUF_SIZE__maxBlockLength
+		int32_t _nominal_block_size; ///< LV2_BUF_SIZE__nominalBlockLength
+
+#ifdef OFFLINE_BLOCKSIZE
+		/* offline rendering with larger blocks */
+		void set_aggregate (bool);
+		void grow_atom_in (uint32_t size);
+		void process_aggregated (float** inputs, float** outputs, int32_t n_samples);
+
+		bool     _agg_active;
+		int32_t  _agg_block_size;
+		int32_t  _agg_pos;
+		float**  _agg_in;
+		float**  _agg_out;
+		LV2_Atom_Sequence* _agg_atom_out; ///< MIDI output of the previous block
+		VstTimeInfo _agg_ti;
+		bool     _agg_ti_valid;
+#endif
+
+		uint32_t _n_mono;      ///< number of plugin instances
+		uint32_t _n_audio_in;  ///< VST inputs, _n_mono * nports_audio_in
+		uint32_t _n_audio_out; ///< VST outputs, _n_mono * nports_audio_out
+
+#ifdef MULTI_MONO
+		/* additional instances, one per channel. Control inputs are
+		 * shared with the first instance, outputs are discarded */
+		struct MonoInstance {
+			LV2_Handle          handle;
+			LV2_Worker_Schedule schedule;
+			Lv2Worker*          worker;
+			float*              ports;
+			LV2_Atom_Sequence*  atom_out;
+		};
+
+		void mono_start ();
+		void mono_stop ();
+		void mono_work ();
+		void run_mono (int32_t n_samples);
+		void run_instance (uint32_t k, int32_t n_samples);
+		static void mono_job (void*);
+
+		MonoInstance* _mono;
+		Lv2ParallelPool* _mono_pool;    ///< process-wide, while active
+		Lv2ParallelPool::Job _mono_job;
+		int32_t       _mono_n_samples;
+		uint32_t      _mono_next;       ///< next instance to process
+		uint32_t      _mono_pending;    ///< instances not yet done
+		Lv2VstUtil::Semaphore _mono_done;
+#endif
+
+#ifdef PIPELINE
+		/* run the plugin in a dedicated thread, one block behind the host */
+		void pipe_start ();
+		void pipe_stop ();
+		void process_pipelined (float** inputs, float** outputs, int32_t n_samples);
+		static void* pipe_thread (void*);
+
+		Lv2VstUtil::DirtyValues _ctrl_in; ///< parameter changes, applied by prepare_block ()
+
+		bool     _pipe_active;
+		bool     _pipe_run;
+		bool     _pipe_busy;    ///< a block is being processed
+		bool     _pipe_sched;   ///< thread-priority was set
+		int32_t  _pipe_latency; ///< added latency, host's max block-size
+		int32_t  _pipe_n_samples;
+		float**  _pipe_in;
+		float**  _pipe_out;
+		Lv2VstUtil::RingBuffer<float>** _pipe_fifo; ///< output, delayed by _pipe_latency
+		pthread_t _pipe_thread;
+		Lv2VstUtil::Semaphore _pipe_start;
+		Lv2VstUtil::Semaphore _pipe_done;
+#endif
 		VstTimeInfo _ti;
 
 		char _vsthost_product_str[64];
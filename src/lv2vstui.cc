@@ -191,27 +191,45 @@ void Lv2VstUI::idle ()
 		return;
 	}
 
-	while (_lv2vst->ctrl_to_ui.read_space () >= 1) {
-		LV2Vst::ParamVal pv;
-		_lv2vst->ctrl_to_ui.read (&pv, 1);
-		_port_event_recursion = pv.p;
-		plugin_gui->port_event (gui_instance, pv.p, sizeof (float), 0, &pv.v);
-		_port_event_recursion = UINT32_MAX;
+	/* deliver the most recent value of each port that changed since the last call */
+	Lv2VstUtil::DirtyValues& ctrl = _lv2vst->ctrl_to_ui;
+	for (uint32_t w = 0; w < ctrl.n_words (); ++w) {
+		uint32_t bits = ctrl.take (w);
+		while (bits) {
+			const uint32_t p = 32 * w + __builtin_ctz (bits);
+			const float v = ctrl.value (p);
+			bits &= bits - 1;
+			_port_event_recursion = p;
+			plugin_gui->port_event (gui_instance, p, sizeof (float), 0, &v);
+			_port_event_recursion = UINT32_MAX;
+		}
 	}
 
 	const uint32_t portmap_atom_to_ui = _lv2vst->portmap_atom_to_ui ();
 
 	while (_lv2vst->atom_to_ui.read_space () > sizeof (LV2_Atom) && portmap_atom_to_ui != UINT32_MAX) {
 		LV2_Atom a;
-		_lv2vst->atom_to_ui.read ((char *) &a, sizeof (LV2_Atom));
-		_lv2vst->atom_to_ui.read ((char *) _atombuf, a.size);
-		LV2_Atom_Event const* ev = (LV2_Atom_Event const*)((&(_atombuf)->body) + 1); // lv2_atom_sequence_begin
-		while ((const uint8_t*)ev < ((const uint8_t*) &(_atombuf)->body + (_atombuf)->atom.size)) {
+		Lv2VstUtil::RingBuffer<char>::rw_vector vec;
+		_lv2vst->atom_to_ui.get_read_vector (&vec);
+		_lv2vst->atom_to_ui.vector_read (vec, 0, (char *) &a, sizeof (LV2_Atom));
+
+		/* use the sequence in-place, unless it wraps around */
+		LV2_Atom_Sequence const* seq;
+		if (vec.len[0] >= sizeof (LV2_Atom) + a.size) {
+			seq = (LV2_Atom_Sequence const*) &vec.buf[0][sizeof (LV2_Atom)];
+		} else {
+			_lv2vst->atom_to_ui.vector_read (vec, sizeof (LV2_Atom), (char *) _atombuf, a.size);
+			seq = _atombuf;
+		}
+
+		LV2_Atom_Event const* ev = (LV2_Atom_Event const*)((&(seq)->body) + 1); // lv2_atom_sequence_begin
+		while ((const uint8_t*)ev < ((const uint8_t*) &(seq)->body + (seq)->atom.size)) {
 			plugin_gui->port_event (gui_instance, portmap_atom_to_ui,
 					ev->body.size, _uri_atom_EventTransfer, &ev->body);
 			ev = (LV2_Atom_Event const*) /* lv2_atom_sequence_next() */
 				((const uint8_t*)ev + sizeof (LV2_Atom_Event) + ((ev->body.size + 7) & ~7));
 		}
+		_lv2vst->atom_to_ui.advance (sizeof (LV2_Atom) + a.size);
 	}
 
 	if (_idle_iface) {
@@ -229,8 +247,11 @@ Lv2VstUI::write_to_dsp (uint32_t port_index, uint32_t buffer_size, uint32_t port
 	if (port_protocol != 0) {
 		if (_lv2vst->atom_from_ui.write_space () >= buffer_size + sizeof (LV2_Atom)) {
 			LV2_Atom a = {buffer_size, 0};
-			_lv2vst->atom_from_ui.write ((char *) &a, sizeof (LV2_Atom));
-			_lv2vst->atom_from_ui.write ((char *) buffer, buffer_size);
+			Lv2VstUtil::RingBuffer<char>::rw_vector vec;
+			_lv2vst->atom_from_ui.get_write_vector (&vec);
+			_lv2vst->atom_from_ui.vector_write (vec, 0, (char *) &a, sizeof (LV2_Atom));
+			_lv2vst->atom_from_ui.vector_write (vec, sizeof (LV2_Atom), (char *) buffer, buffer_size);
+			_lv2vst->atom_from_ui.commit (sizeof (LV2_Atom) + buffer_size);
 		}
 		return;
 	}
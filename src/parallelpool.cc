@@ -0,0 +1,227 @@
+/*
+ *  Copyright (C) 2016 Robin Gareus <robin@gareus.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <assert.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "parallelpool.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+#ifndef PARALLEL_SPIN
+# define PARALLEL_SPIN 1000 // end (): busy-wait iterations before blocking
+#endif
+
+static uint32_t n_cpu_cores ()
+{
+#ifdef _WIN32
+	SYSTEM_INFO si;
+	GetSystemInfo (&si);
+	long n = si.dwNumberOfProcessors;
+#else
+	long n = sysconf (_SC_NPROCESSORS_ONLN);
+#endif
+	return n > 0 ? n : 1;
+}
+
+static inline void cpu_pause ()
+{
+#if defined __i386__ || defined __x86_64__
+	__builtin_ia32_pause ();
+#endif
+}
+
+Lv2ParallelPool* Lv2ParallelPool::_instance = NULL;
+uint32_t         Lv2ParallelPool::_refcnt = 0;
+pthread_mutex_t  Lv2ParallelPool::_instance_lock = PTHREAD_MUTEX_INITIALIZER;
+
+Lv2ParallelPool* Lv2ParallelPool::acquire ()
+{
+	pthread_mutex_lock (&_instance_lock);
+	if (_refcnt++ == 0) {
+		/* the calling thread participates, one thread per remaining core */
+		_instance = new Lv2ParallelPool (n_cpu_cores () - 1);
+	}
+	Lv2ParallelPool* pool = _instance;
+	pthread_mutex_unlock (&_instance_lock);
+	return pool;
+}
+
+void Lv2ParallelPool::release ()
+{
+	pthread_mutex_lock (&_instance_lock);
+	assert (_refcnt > 0);
+	if (--_refcnt == 0) {
+		delete _instance;
+		_instance = NULL;
+	}
+	pthread_mutex_unlock (&_instance_lock);
+}
+
+Lv2ParallelPool::Lv2ParallelPool (uint32_t n_threads)
+	: _n_threads (0)
+	, _sched (false)
+	, _run (true)
+{
+	for (uint32_t i = 0; i < N_SLOTS; ++i) {
+		_slots[i].job = NULL;
+		_slots[i].busy = 0;
+		_slots[i].users = 0;
+		_slots[i].waiting = 0;
+	}
+	_threads = (pthread_t*) malloc ((n_threads > 0 ? n_threads : 1) * sizeof (pthread_t));
+	for (uint32_t i = 0; i < n_threads; ++i) {
+		if (pthread_create (&_threads[_n_threads], NULL, thread_func, this) == 0) {
+			++_n_threads;
+		}
+	}
+}
+
+Lv2ParallelPool::~Lv2ParallelPool ()
+{
+	__atomic_store_n (&_run, false, __ATOMIC_RELEASE);
+	for (uint32_t i = 0; i < _n_threads; ++i) {
+		_sem.signal ();
+	}
+	for (uint32_t i = 0; i < _n_threads; ++i) {
+		pthread_join (_threads[i], NULL);
+	}
+	free (_threads);
+}
+
+void* Lv2ParallelPool::thread_func (void* data)
+{
+	Lv2ParallelPool* self = (Lv2ParallelPool*)data;
+	self->run ();
+	return NULL;
+}
+
+/* pool threads use the same priority as the first process thread */
+void Lv2ParallelPool::set_priority ()
+{
+	int policy;
+	struct sched_param param;
+	if (pthread_getschedparam (pthread_self (), &policy, &param) == 0) {
+		for (uint32_t t = 0; t < _n_threads; ++t) {
+			pthread_setschedparam (_threads[t], policy, &param);
+		}
+	}
+	__atomic_store_n (&_sched, true, __ATOMIC_RELAXED);
+}
+
+/* called from the process thread: publish the job in a free slot and
+ * wake up to `n_wakeup` threads. Returns false if the job has to be
+ * processed by the caller alone. */
+bool Lv2ParallelPool::begin (Job* job, uint32_t n_wakeup)
+{
+	if (_n_threads == 0) {
+		return false;
+	}
+	if (!__atomic_load_n (&_sched, __ATOMIC_RELAXED)) {
+		set_priority ();
+	}
+	for (uint32_t i = 0; i < N_SLOTS; ++i) {
+		uint32_t idle = 0;
+		if (__atomic_compare_exchange_n (&_slots[i].busy, &idle, 1, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+			__atomic_store_n (&_slots[i].job, job, __ATOMIC_SEQ_CST);
+			if (n_wakeup > _n_threads) {
+				n_wakeup = _n_threads;
+			}
+			for (uint32_t t = 0; t < n_wakeup; ++t) {
+				_sem.signal ();
+			}
+			return true;
+		}
+	}
+	return false;
+}
+
+/* called from the process thread after the job is complete: unpublish it,
+ * and wait for pool threads that may still access the job to leave.
+ * Those are usually about to return from work (), so spin briefly,
+ * then block until the last one signals. The slot is only released
+ * for a new job after that. */
+void Lv2ParallelPool::end (Job* job)
+{
+	for (uint32_t i = 0; i < N_SLOTS; ++i) {
+		Slot& s = _slots[i];
+		if (__atomic_load_n (&s.job, __ATOMIC_RELAXED) != job) {
+			continue;
+		}
+		__atomic_store_n (&s.job, (Job*)0, __ATOMIC_SEQ_CST);
+		wait_users (s);
+		__atomic_store_n (&s.busy, 0, __ATOMIC_RELEASE);
+		return;
+	}
+}
+
+void Lv2ParallelPool::wait_users (Slot& s)
+{
+	for (uint32_t n = 0; n < PARALLEL_SPIN; ++n) {
+		if (__atomic_load_n (&s.users, __ATOMIC_SEQ_CST) == 0) {
+			return;
+		}
+		cpu_pause ();
+	}
+
+	__atomic_store_n (&s.waiting, 1, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n (&s.users, __ATOMIC_SEQ_CST) == 0) {
+		/* all left meanwhile, unless one of them already took the flag */
+		if (__atomic_exchange_n (&s.waiting, 0, __ATOMIC_SEQ_CST) == 1) {
+			return;
+		}
+	}
+	s.left.wait ();
+}
+
+/* the last thread to leave a slot wakes up a waiting end () */
+void Lv2ParallelPool::leave (uint32_t i)
+{
+	Slot& s = _slots[i];
+	if (__atomic_sub_fetch (&s.users, 1, __ATOMIC_SEQ_CST) == 0) {
+		if (__atomic_exchange_n (&s.waiting, 0, __ATOMIC_SEQ_CST) == 1) {
+			s.left.signal ();
+		}
+	}
+}
+
+/* a thread registers as user of a slot before reading the job, so
+ * end () cannot return while the job is being accessed. */
+void Lv2ParallelPool::run ()
+{
+	while (1) {
+		_sem.wait ();
+		if (!__atomic_load_n (&_run, __ATOMIC_ACQUIRE)) {
+			break;
+		}
+		for (uint32_t i = 0; i < N_SLOTS; ++i) {
+			Slot& s = _slots[i];
+			if (!__atomic_load_n (&s.job, __ATOMIC_RELAXED)) {
+				continue;
+			}
+			__atomic_fetch_add (&s.users, 1, __ATOMIC_SEQ_CST);
+			Job* job = __atomic_load_n (&s.job, __ATOMIC_SEQ_CST);
+			if (job) {
+				job->work (job->arg);
+			}
+			leave (i);
+		}
+	}
+}
@@ -0,0 +1,83 @@
+/*
+ *  Copyright (C) 2016 Robin Gareus <robin@gareus.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef _parallelpool_h_
+#define _parallelpool_h_
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include "rtsemaphore.h"
+
+/* process-wide realtime threads, shared by all multi-mono plugins.
+ *
+ * A job is published by the calling (process) thread, which wakes up
+ * some idle pool threads and works on the job as well. Pool threads
+ * call job->work (job->arg) for every published job, work () must
+ * return as soon as nothing is left to do.
+ */
+class Lv2ParallelPool
+{
+	public:
+		struct Job {
+			void (*work) (void*);
+			void* arg;
+		};
+
+		static Lv2ParallelPool* acquire ();
+		static void release ();
+
+		uint32_t n_threads () const { return _n_threads; }
+
+		bool begin (Job*, uint32_t n_wakeup);
+		void end (Job*);
+
+	private:
+		Lv2ParallelPool (uint32_t n_threads);
+		~Lv2ParallelPool ();
+
+		static void* thread_func (void*);
+		void run ();
+		void set_priority ();
+		void leave (uint32_t slot);
+
+		enum { N_SLOTS = 64 };
+
+		struct Slot {
+			Job*     job;     ///< published job, NULL once it is complete
+			uint32_t busy;    ///< 1: slot is in use by begin () .. end ()
+			uint32_t users;   ///< threads that may access job
+			uint32_t waiting; ///< 1: end () waits for users to leave
+			Lv2VstUtil::Semaphore left;
+		};
+
+		void wait_users (Slot&);
+
+		Slot            _slots[N_SLOTS];
+		pthread_t*      _threads;
+		uint32_t        _n_threads;
+		bool            _sched; ///< thread-priority was set
+		Lv2VstUtil::Semaphore _sem;
+		bool            _run;
+
+		static Lv2ParallelPool* _instance;
+		static uint32_t         _refcnt;
+		static pthread_mutex_t  _instance_lock;
+};
+
+#endif
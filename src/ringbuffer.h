@@ -22,34 +22,25 @@
 #include <cstring> // memcpy
 #include <stdint.h>
 
-#ifdef __clang__
-# if __has_feature(cxx_atomic)
-#  define CLANG_CXX11_ATOMICS 1
-# endif
-#endif
-
-#ifdef CLANG_CXX11_ATOMICS
-#include <atomic>
-
-#define _atomic_int_get(P)    (P)
-#define _atomic_int_set(P, V) (P) = (V)
-#define adef std::atomic<uint32_t>
-#define avar std::atomic<uint32_t>
-
-#elif defined __ATOMIC_SEQ_CST && !defined __clang__
+/* single-producer, single-consumer lock-free ringbuffer.
+ *
+ * The size is rounded up to a power of two, indices wrap by masking.
+ * The producer publishes data by store-release of the write-index,
+ * the consumer acquires it (and vice versa for the read-index).
+ * Read and write indices are kept on separate cache-lines.
+ */
 
-#define _atomic_int_get(P)    __atomic_load_4 (&(P), __ATOMIC_SEQ_CST)
-#define _atomic_int_set(P, V) __atomic_store_4 (&(P), (V), __ATOMIC_SEQ_CST)
+#if defined __ATOMIC_ACQUIRE
 
-#define adef uint32_t
-#define avar uint32_t
+#define _atomic_int_get(P)    __atomic_load_n (&(P), __ATOMIC_ACQUIRE)
+#define _atomic_int_set(P, V) __atomic_store_n (&(P), (V), __ATOMIC_RELEASE)
+#define adef size_t
 
 #elif defined __GNUC__
 
 #define _atomic_int_set(P,V) __sync_lock_test_and_set (&(P), (V))
 #define _atomic_int_get(P)   __sync_add_and_fetch (&(P), 0)
-#define adef volatile uint32_t
-#define avar uint32_t
+#define adef volatile size_t
 
 #else
 
@@ -58,17 +49,24 @@
 #define _atomic_int_set(P,V) P = (V)
 #define _atomic_int_get(P) P
 #define adef size_t
-#define avar size_t
 
 #endif
 
+#ifndef LV2VST_CACHELINE_SIZE
+# define LV2VST_CACHELINE_SIZE 64
+#endif
+
 namespace Lv2VstUtil {
 
 template<class T> class RingBuffer
 {
 	public:
 		RingBuffer (size_t s) {
-			size = s;
+			size = 1;
+			while (size < s) {
+				size <<= 1;
+			}
+			size_mask = size - 1;
 			buf = new T[size];
 			reset ();
 		}
@@ -82,120 +80,250 @@ template<class T> class RingBuffer
 			_atomic_int_set (read_ptr, 0);
 		}
 
+		/* up to two contiguous regions, the 2nd one is used when wrapping */
+		struct rw_vector {
+			T*     buf[2];
+			size_t len[2];
+		};
+
 		size_t read  (T *dest, size_t cnt);
 		size_t write (const T *src, size_t cnt);
 
-		size_t write_space () {
-			size_t w, r;
+		/* zero-copy access: get_write_vector() returns the free space,
+		 * data written there becomes visible to the reader by commit().
+		 * get_read_vector() returns readable data, advance() releases it.
+		 */
+		void get_write_vector (rw_vector* vec);
+		void get_read_vector (rw_vector* vec);
 
-			w = _atomic_int_get (write_ptr);
-			r = _atomic_int_get (read_ptr);
+		void commit (size_t cnt) {
+			_atomic_int_set (write_ptr, (_atomic_int_get (write_ptr) + cnt) & size_mask);
+		}
 
-			if (w > r) {
-				return ((r - w + size) % size) - 1;
-			} else if (w < r) {
-				return (r - w) - 1;
-			} else {
-				return size - 1;
-			}
+		void advance (size_t cnt) {
+			_atomic_int_set (read_ptr, (_atomic_int_get (read_ptr) + cnt) & size_mask);
 		}
 
-		size_t read_space () {
-			avar w;
-			avar r;
+		/* copy data from/to a vector, starting at offset `off` */
+		static void vector_write (rw_vector const& vec, size_t off, const T* src, size_t cnt);
+		static void vector_read (rw_vector const& vec, size_t off, T* dest, size_t cnt);
 
-			w = _atomic_int_get (write_ptr);
-			r = _atomic_int_get (read_ptr);
+		size_t write_space () const {
+			size_t w = _atomic_int_get (write_ptr);
+			size_t r = _atomic_int_get (read_ptr);
+			return (r - w - 1) & size_mask;
+		}
 
-			if (w > r) {
-				return w - r;
-			} else {
-				return (w - r + size) % size;
-			}
+		size_t read_space () const {
+			size_t w = _atomic_int_get (write_ptr);
+			size_t r = _atomic_int_get (read_ptr);
+			return (w - r) & size_mask;
 		}
 
 	protected:
 		T *buf;
 		size_t size;
+		size_t size_mask;
+
+		char _pad0[LV2VST_CACHELINE_SIZE];
 		adef write_ptr;
+		char _pad1[LV2VST_CACHELINE_SIZE - sizeof (size_t)];
 		adef read_ptr;
+		char _pad2[LV2VST_CACHELINE_SIZE - sizeof (size_t)];
 };
 
-template<class T> size_t RingBuffer<T>::read (T *dest, size_t cnt)
+template<class T> void RingBuffer<T>::get_write_vector (rw_vector* vec)
 {
-	size_t free_cnt;
-	size_t cnt2;
-	size_t to_read;
-	size_t n1, n2;
-	size_t my_read_ptr;
+	size_t w = _atomic_int_get (write_ptr);
+	size_t r = _atomic_int_get (read_ptr);
+	size_t free_cnt = (r - w - 1) & size_mask;
+	size_t cnt2 = w + free_cnt;
 
-	my_read_ptr = _atomic_int_get (read_ptr);
-
-	if ((free_cnt = read_space ()) == 0) {
-		return 0;
+	vec->buf[0] = &buf[w];
+	if (cnt2 > size) {
+		vec->len[0] = size - w;
+		vec->buf[1] = buf;
+		vec->len[1] = cnt2 & size_mask;
+	} else {
+		vec->len[0] = free_cnt;
+		vec->buf[1] = 0;
+		vec->len[1] = 0;
 	}
+}
 
-	to_read = cnt > free_cnt ? free_cnt : cnt;
-
-	cnt2 = my_read_ptr + to_read;
+template<class T> void RingBuffer<T>::get_read_vector (rw_vector* vec)
+{
+	size_t w = _atomic_int_get (write_ptr);
+	size_t r = _atomic_int_get (read_ptr);
+	size_t free_cnt = (w - r) & size_mask;
+	size_t cnt2 = r + free_cnt;
 
+	vec->buf[0] = &buf[r];
 	if (cnt2 > size) {
-		n1 = size - my_read_ptr;
-		n2 = cnt2 % size;
+		vec->len[0] = size - r;
+		vec->buf[1] = buf;
+		vec->len[1] = cnt2 & size_mask;
+	} else {
+		vec->len[0] = free_cnt;
+		vec->buf[1] = 0;
+		vec->len[1] = 0;
+	}
+}
+
+template<class T> void RingBuffer<T>::vector_write (rw_vector const& vec, size_t off, const T* src, size_t cnt)
+{
+	if (off < vec.len[0]) {
+		size_t n1 = vec.len[0] - off;
+		if (n1 > cnt) {
+			n1 = cnt;
+		}
+		memcpy (&vec.buf[0][off], src, n1 * sizeof (T));
+		src += n1;
+		cnt -= n1;
+		off = 0;
+	} else {
+		off -= vec.len[0];
+	}
+	if (cnt > 0) {
+		memcpy (&vec.buf[1][off], src, cnt * sizeof (T));
+	}
+}
+
+template<class T> void RingBuffer<T>::vector_read (rw_vector const& vec, size_t off, T* dest, size_t cnt)
+{
+	if (off < vec.len[0]) {
+		size_t n1 = vec.len[0] - off;
+		if (n1 > cnt) {
+			n1 = cnt;
+		}
+		memcpy (dest, &vec.buf[0][off], n1 * sizeof (T));
+		dest += n1;
+		cnt -= n1;
+		off = 0;
 	} else {
-		n1 = to_read;
-		n2 = 0;
+		off -= vec.len[0];
+	}
+	if (cnt > 0) {
+		memcpy (dest, &vec.buf[1][off], cnt * sizeof (T));
 	}
+}
 
-	memcpy (dest, &buf[my_read_ptr], n1 * sizeof (T));
-	my_read_ptr = (my_read_ptr + n1) % size;
+template<class T> size_t RingBuffer<T>::read (T *dest, size_t cnt)
+{
+	rw_vector vec;
+	get_read_vector (&vec);
 
-	if (n2) {
-		memcpy (dest+n1, buf, n2 * sizeof (T));
-		my_read_ptr = n2;
+	size_t to_read = vec.len[0] + vec.len[1];
+	if (to_read == 0) {
+		return 0;
+	}
+	if (cnt < to_read) {
+		to_read = cnt;
 	}
 
-	_atomic_int_set (read_ptr, my_read_ptr);
+	vector_read (vec, 0, dest, to_read);
+	advance (to_read);
 	return to_read;
 }
 
 template<class T> size_t RingBuffer<T>::write (const T *src, size_t cnt)
 {
-	size_t free_cnt;
-	size_t cnt2;
-	size_t to_write;
-	size_t n1, n2;
-	size_t my_write_ptr;
+	rw_vector vec;
+	get_write_vector (&vec);
 
-	my_write_ptr = _atomic_int_get (write_ptr);
-
-	if ((free_cnt = write_space ()) == 0) {
+	size_t to_write = vec.len[0] + vec.len[1];
+	if (to_write == 0) {
 		return 0;
 	}
+	if (cnt < to_write) {
+		to_write = cnt;
+	}
 
-	to_write = cnt > free_cnt ? free_cnt : cnt;
+	vector_write (vec, 0, src, to_write);
+	commit (to_write);
+	return to_write;
+}
 
-	cnt2 = my_write_ptr + to_write;
+/* variable-size messages on top of RingBuffer<char>.
+ *
+ * Each message is a frame: an 8 byte header (payload size and an optional
+ * 32bit user-provided stamp) followed by the payload, padded to 8 bytes.
+ * A frame never wraps around, if it does not fit at the end of the buffer,
+ * a skip-marker is written instead and the frame starts at the beginning.
+ * So every message can be read in-place, header and payload are made
+ * visible to the reader at once.
+ */
+class MessageRing : public RingBuffer<char>
+{
+	public:
+		MessageRing (size_t s) : RingBuffer<char> (s), _frame_len (0) {}
 
-	if (cnt2 > size) {
-		n1 = size - my_write_ptr;
-		n2 = cnt2 % size;
-	} else {
-		n1 = to_write;
-		n2 = 0;
-	}
+		/* largest message that can always be written into an empty buffer */
+		size_t max_message_size () const {
+			return (size / 2) - 2 * sizeof (uint64_t);
+		}
 
-	memcpy (&buf[my_write_ptr], src, n1 * sizeof (T));
-	my_write_ptr = (my_write_ptr + n1) % size;
+		bool write_message (const void* data, uint32_t msg_size, uint32_t stamp = 0) {
+			const size_t len = frame_len (msg_size);
+			rw_vector vec;
+			get_write_vector (&vec);
+
+			char* dst;
+			size_t skip = 0;
+			if (vec.len[0] >= len) {
+				dst = vec.buf[0];
+			} else if (vec.len[1] >= len) {
+				/* frames are 8 byte aligned, and so is the end of the buffer */
+				uint64_t marker = SKIP;
+				memcpy (vec.buf[0], &marker, sizeof (uint64_t));
+				skip = vec.len[0];
+				dst = vec.buf[1];
+			} else {
+				return false;
+			}
 
-	if (n2) {
-		memcpy (buf, src+n1, n2 * sizeof (T));
-		my_write_ptr = n2;
-	}
+			uint64_t hdr = ((uint64_t)stamp << 32) | msg_size;
+			memcpy (dst, &hdr, sizeof (uint64_t));
+			memcpy (dst + sizeof (uint64_t), data, msg_size);
+			commit (skip + len);
+			return true;
+		}
 
-	_atomic_int_set (write_ptr, my_write_ptr);
-	return to_write;
-}
+		/* return the next message (NULL if none), which remains valid until release_message () */
+		const void* peek_message (uint32_t* msg_size, uint32_t* stamp = NULL) {
+			rw_vector vec;
+			get_read_vector (&vec);
+			if (vec.len[0] + vec.len[1] < sizeof (uint64_t)) {
+				return NULL;
+			}
+			uint64_t hdr;
+			memcpy (&hdr, vec.buf[0], sizeof (uint64_t));
+			if (hdr == SKIP) {
+				advance (vec.len[0]);
+				return peek_message (msg_size, stamp);
+			}
+			*msg_size  = hdr & 0xffffffff;
+			_frame_len = frame_len (*msg_size);
+			if (stamp) {
+				*stamp = hdr >> 32;
+			}
+			return vec.buf[0] + sizeof (uint64_t);
+		}
+
+		void release_message () {
+			advance (_frame_len);
+			_frame_len = 0;
+		}
+
+	private:
+		static const uint64_t SKIP = ~((uint64_t)0);
+
+		static size_t frame_len (size_t msg_size) {
+			return sizeof (uint64_t) + ((msg_size + 7) & ~((size_t)7));
+		}
+
+		size_t _frame_len;
+};
 
 } /* namespace */
 
@@ -0,0 +1,74 @@
+/*
+ *  Copyright (C) 2016 Robin Gareus <robin@gareus.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef _rtsemaphore_h_
+#define _rtsemaphore_h_
+
+#ifdef _WIN32
+# include <windows.h>
+#elif defined __APPLE__
+# include <mach/mach.h>
+#else
+# include <errno.h>
+# include <semaphore.h>
+#endif
+
+namespace Lv2VstUtil {
+
+/* counting semaphore.
+ *
+ * signal() never blocks and is safe to call from a realtime thread,
+ * every signal() wakes up exactly one wait().
+ */
+class Semaphore
+{
+	public:
+#ifdef _WIN32
+		Semaphore () { _sem = CreateSemaphore (NULL, 0, 0x7fffffff, NULL); }
+		~Semaphore () { CloseHandle (_sem); }
+		void signal () { ReleaseSemaphore (_sem, 1, NULL); }
+		void wait () { WaitForSingleObject (_sem, INFINITE); }
+	private:
+		HANDLE _sem;
+#elif defined __APPLE__
+		Semaphore () { semaphore_create (mach_task_self (), &_sem, SYNC_POLICY_FIFO, 0); }
+		~Semaphore () { semaphore_destroy (mach_task_self (), _sem); }
+		void signal () { semaphore_signal (_sem); }
+		void wait () {
+			while (semaphore_wait (_sem) == KERN_ABORTED) ;
+		}
+	private:
+		semaphore_t _sem;
+#else
+		Semaphore () { sem_init (&_sem, 0, 0); }
+		~Semaphore () { sem_destroy (&_sem); }
+		void signal () { sem_post (&_sem); }
+		void wait () {
+			while (sem_wait (&_sem) != 0 && errno == EINTR) ;
+		}
+	private:
+		sem_t _sem;
+#endif
+
+		Semaphore (Semaphore const&);
+		Semaphore& operator= (Semaphore const&);
+};
+
+} /* namespace */
+
+#endif
@@ -0,0 +1,725 @@
+/*
+ *  Copyright (C) 2016 Robin Gareus <robin@gareus.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "lilv_config.h"
+
+#include "loadlib.h"
+#include "lv2ttl.h"
+#include "scancache.h"
+
+extern "C" {
+	char* lilv_expand (const char* path);
+	void  lilv_dir_for_each (const char* path, void* data, void (*f)(const char* path, const char* name, void* data));
+}
+
+/* bump this whenever the file-format or RtkLv2Description changes */
+#define SCAN_CACHE_VERSION 2
+
+static const char scan_cache_magic[8] = { 'L', 'V', '2', 'V', 'S', 'T', 'S', 'C' };
+
+#ifdef _WIN32
+# define COMPOSE_FN "%s\\%s"
+#else
+# define COMPOSE_FN "%s/%s"
+#endif
+
+/* ****************************************************************************
+ * bundle identification
+ */
+
+static bool is_dir_sep (const char c)
+{
+	return c == '/' || c == LILV_DIR_SEP[0];
+}
+
+/* collapse duplicate separators and remove trailing ones,
+ * so that paths from lilv and readdir compare equal */
+static char* normalize_path (const char* path)
+{
+	char* rv = (char*) malloc (strlen (path) + 1);
+	char* d = rv;
+	for (const char* s = path; *s; ++s) {
+		if (is_dir_sep (*s) && d > rv && is_dir_sep (d[-1])) {
+			continue;
+		}
+		*d++ = *s;
+	}
+	while (d > rv + 1 && is_dir_sep (d[-1])) {
+		--d;
+	}
+	*d = 0;
+	return rv;
+}
+
+static uint64_t fnv1a64 (uint64_t h, const void* data, size_t len)
+{
+	const uint8_t* p = (const uint8_t*) data;
+	for (size_t i = 0; i < len; ++i) {
+		h ^= p[i];
+		h *= 0x100000001b3ULL;
+	}
+	return h;
+}
+
+struct BundleKey {
+	uint64_t key;
+	bool     has_manifest;
+};
+
+static void bundle_key_file (const char* dir, const char* name, void* data)
+{
+	BundleKey* bk = (BundleKey*) data;
+	size_t len = strlen (name);
+	if (len < 5 || strcmp (name + len - 4, ".ttl")) {
+		return;
+	}
+
+	char fn[1024];
+	snprintf (fn, 1023, COMPOSE_FN, dir, name);
+	fn[1023] = 0;
+
+	struct stat st;
+	if (stat (fn, &st)) {
+		return;
+	}
+
+	if (!strcmp (name, "manifest.ttl")) {
+		bk->has_manifest = true;
+	}
+
+	uint64_t mtime = st.st_mtime;
+	uint64_t fsize = st.st_size;
+	uint64_t h = 0xcbf29ce484222325ULL;
+	h = fnv1a64 (h, name, len);
+	h = fnv1a64 (h, &mtime, sizeof (mtime));
+	h = fnv1a64 (h, &fsize, sizeof (fsize));
+	/* sum, so that the key does not depend on readdir order */
+	bk->key += h;
+}
+
+/* 0: not a bundle */
+static uint64_t bundle_key (const char* path)
+{
+	BundleKey bk = { 0, false };
+	lilv_dir_for_each (path, &bk, bundle_key_file);
+	if (!bk.has_manifest || bk.key == 0) {
+		return 0;
+	}
+	return bk.key;
+}
+
+/* ****************************************************************************
+ * serialization helpers
+ */
+
+class CacheWriter
+{
+	public:
+		CacheWriter (FILE* f) : _f (f), _ok (true) {}
+
+		bool ok () const { return _ok; }
+
+		void data (const void* d, size_t s) {
+			if (_ok && s > 0 && fwrite (d, s, 1, _f) != 1) {
+				_ok = false;
+			}
+		}
+
+		void u8 (uint8_t v)   { data (&v, sizeof (v)); }
+		void u32 (uint32_t v) { data (&v, sizeof (v)); }
+		void u64 (uint64_t v) { data (&v, sizeof (v)); }
+		void f32 (float v)    { data (&v, sizeof (v)); }
+
+		void str (const char* s) {
+			if (!s) {
+				u32 (UINT32_MAX);
+				return;
+			}
+			uint32_t len = strlen (s);
+			u32 (len);
+			data (s, len);
+		}
+
+	private:
+		FILE* _f;
+		bool  _ok;
+};
+
+class CacheReader
+{
+	public:
+		CacheReader (const uint8_t* d, size_t s) : _d (d), _end (d + s), _ok (true) {}
+
+		bool ok () const { return _ok; }
+
+		bool data (void* d, size_t s) {
+			if (!_ok || (size_t)(_end - _d) < s) {
+				_ok = false;
+				return false;
+			}
+			memcpy (d, _d, s);
+			_d += s;
+			return true;
+		}
+
+		uint8_t  u8 ()  { uint8_t v = 0;  data (&v, sizeof (v)); return v; }
+		uint32_t u32 () { uint32_t v = 0; data (&v, sizeof (v)); return v; }
+		uint64_t u64 () { uint64_t v = 0; data (&v, sizeof (v)); return v; }
+		float    f32 () { float v = 0;    data (&v, sizeof (v)); return v; }
+
+		char* str () {
+			uint32_t len = u32 ();
+			if (!_ok || len == UINT32_MAX) {
+				return NULL;
+			}
+			if ((size_t)(_end - _d) < len) {
+				_ok = false;
+				return NULL;
+			}
+			char* s = (char*) malloc (len + 1);
+			memcpy (s, _d, len);
+			s[len] = 0;
+			_d += len;
+			return s;
+		}
+
+	private:
+		const uint8_t* _d;
+		const uint8_t* _end;
+		bool _ok;
+};
+
+static void write_desc (CacheWriter& w, RtkLv2Description const* d)
+{
+	w.str (d->dsp_uri);
+	w.str (d->gui_uri);
+	w.u32 (d->id);
+	w.str (d->plugin_name);
+	w.str (d->vendor);
+	w.str (d->bundle_path);
+	w.str (d->dsp_path);
+	w.str (d->gui_path);
+	w.u32 (d->version_minor);
+	w.u32 (d->version_micro);
+	w.u32 (d->nports_total);
+	w.u32 (d->nports_audio_in);
+	w.u32 (d->nports_audio_out);
+	w.u32 (d->nports_midi_in);
+	w.u32 (d->nports_midi_out);
+	w.u32 (d->nports_atom_in);
+	w.u32 (d->nports_atom_out);
+	w.u32 (d->nports_ctrl);
+	w.u32 (d->nports_ctrl_in);
+	w.u32 (d->nports_ctrl_out);
+	w.u32 (d->min_atom_bufsiz);
+	w.u32 (d->latency_ctrl_port);
+	w.u32 (d->enable_ctrl_port);
+	w.u8 (d->send_time_info);
+	w.u8 (d->has_state_interface);
+	w.u32 (d->category);
+
+	for (uint32_t i = 0; i < d->nports_total; ++i) {
+		struct LV2Port const* p = &d->ports[i];
+		w.u32 (p->porttype);
+		w.str (p->name);
+		w.str (p->symbol);
+		w.str (p->doc);
+		w.f32 (p->val_default);
+		w.f32 (p->val_min);
+		w.f32 (p->val_max);
+		w.f32 (p->steps);
+		w.u8 (p->toggled);
+		w.u8 (p->integer_step);
+		w.u8 (p->logarithmic);
+		w.u8 (p->sr_dependent);
+		w.u8 (p->enumeration);
+		w.u8 (p->not_on_gui);
+		w.u8 (p->not_automatic);
+	}
+}
+
+static RtkLv2Description* read_desc (CacheReader& r)
+{
+	RtkLv2Description* d = (RtkLv2Description*) calloc (1, sizeof (RtkLv2Description));
+	d->dsp_uri             = r.str ();
+	d->gui_uri             = r.str ();
+	d->id                  = r.u32 ();
+	d->plugin_name         = r.str ();
+	d->vendor              = r.str ();
+	d->bundle_path         = r.str ();
+	d->dsp_path            = r.str ();
+	d->gui_path            = r.str ();
+	d->version_minor       = r.u32 ();
+	d->version_micro       = r.u32 ();
+	uint32_t nports_total  = r.u32 ();
+	d->nports_audio_in     = r.u32 ();
+	d->nports_audio_out    = r.u32 ();
+	d->nports_midi_in      = r.u32 ();
+	d->nports_midi_out     = r.u32 ();
+	d->nports_atom_in      = r.u32 ();
+	d->nports_atom_out     = r.u32 ();
+	d->nports_ctrl         = r.u32 ();
+	d->nports_ctrl_in      = r.u32 ();
+	d->nports_ctrl_out     = r.u32 ();
+	d->min_atom_bufsiz     = r.u32 ();
+	d->latency_ctrl_port   = r.u32 ();
+	d->enable_ctrl_port    = r.u32 ();
+	d->send_time_info      = r.u8 ();
+	d->has_state_interface = r.u8 ();
+	d->category            = (PluginCategory) r.u32 ();
+
+	if (!r.ok () || nports_total > 65536) {
+		free_desc (d);
+		return NULL;
+	}
+
+	d->ports = (struct LV2Port*) calloc (nports_total, sizeof (struct LV2Port));
+	d->nports_total = nports_total;
+
+	for (uint32_t i = 0; i < nports_total; ++i) {
+		struct LV2Port* p = &d->ports[i];
+		p->porttype      = (PortType) r.u32 ();
+		p->name          = r.str ();
+		p->symbol        = r.str ();
+		p->doc           = r.str ();
+		p->val_default   = r.f32 ();
+		p->val_min       = r.f32 ();
+		p->val_max       = r.f32 ();
+		p->steps         = r.f32 ();
+		p->toggled       = r.u8 ();
+		p->integer_step  = r.u8 ();
+		p->logarithmic   = r.u8 ();
+		p->sr_dependent  = r.u8 ();
+		p->enumeration   = r.u8 ();
+		p->not_on_gui    = r.u8 ();
+		p->not_automatic = r.u8 ();
+	}
+
+	if (!r.ok ()) {
+		free_desc (d);
+		return NULL;
+	}
+	return d;
+}
+
+static void free_records (Lv2ScanCache::Record* r, uint32_t n)
+{
+	for (uint32_t i = 0; i < n; ++i) {
+		free (r[i].uri);
+		free (r[i].name);
+		free_desc (r[i].desc);
+	}
+	free (r);
+}
+
+/* ****************************************************************************
+ * Lv2ScanCache
+ */
+
+Lv2ScanCache::Lv2ScanCache (char const* const* bundles)
+	: _bundles (bundles)
+	, _bndl (NULL)
+	, _n_bndl (0)
+	, _records (NULL)
+	, _n_records (0)
+	, _new (NULL)
+	, _n_new (0)
+	, _scanned (false)
+{
+	char fn[1024];
+	snprintf (fn, 1023, COMPOSE_FN, get_lib_path (), ".scancache");
+	fn[1023] = 0;
+	_cache_file = strdup (fn);
+
+	if (!load ()) {
+		free_records (_records, _n_records);
+		_records = NULL;
+		_n_records = 0;
+		for (uint32_t i = 0; i < _n_bndl; ++i) {
+			free (_bndl[i].path);
+		}
+		free (_bndl);
+		_bndl = NULL;
+		_n_bndl = 0;
+	}
+}
+
+Lv2ScanCache::~Lv2ScanCache ()
+{
+	free_records (_records, _n_records);
+	free_records (_new, _n_new);
+	for (uint32_t i = 0; i < _n_bndl; ++i) {
+		free (_bndl[i].path);
+	}
+	free (_bndl);
+	free (_cache_file);
+}
+
+bool
+Lv2ScanCache::load ()
+{
+	FILE* f = fopen (_cache_file, "rb");
+	if (!f) {
+		return false;
+	}
+
+	fseek (f, 0, SEEK_END);
+	long size = ftell (f);
+	fseek (f, 0, SEEK_SET);
+
+	if (size <= 0) {
+		fclose (f);
+		return false;
+	}
+
+	uint8_t* data = (uint8_t*) malloc (size);
+	if (fread (data, size, 1, f) != 1) {
+		free (data);
+		fclose (f);
+		return false;
+	}
+	fclose (f);
+
+	CacheReader r (data, size);
+
+	char magic[8];
+	r.data (magic, sizeof (magic));
+	if (!r.ok () || memcmp (magic, scan_cache_magic, sizeof (magic)) || r.u32 () != SCAN_CACHE_VERSION) {
+		free (data);
+		return false;
+	}
+
+	_n_bndl = r.u32 ();
+	if (!r.ok () || _n_bndl > (uint32_t)size) {
+		_n_bndl = 0;
+		free (data);
+		return false;
+	}
+
+	_bndl = (Bundle*) calloc (_n_bndl, sizeof (Bundle));
+	for (uint32_t i = 0; i < _n_bndl; ++i) {
+		_bndl[i].path = r.str ();
+		_bndl[i].key  = r.u64 ();
+		if (!_bndl[i].path) {
+			_bndl[i].path = strdup ("");
+		}
+	}
+
+	uint32_t n_records = r.u32 ();
+	if (!r.ok () || n_records > (uint32_t)size) {
+		free (data);
+		return false;
+	}
+
+	_records = (Record*) calloc (n_records, sizeof (Record));
+	for (uint32_t i = 0; i < n_records; ++i) {
+		Record* rec = &_records[i];
+		++_n_records;
+		rec->id     = r.u32 ();
+		rec->uri    = r.str ();
+		rec->bundle = r.u32 ();
+		rec->status = (Status) r.u32 ();
+		if (!r.ok () || !rec->uri || rec->bundle >= _n_bndl) {
+			free (data);
+			return false;
+		}
+		if (rec->status == Valid) {
+			rec->desc = read_desc (r);
+			if (!rec->desc) {
+				free (data);
+				return false;
+			}
+		} else if (rec->status == Listed) {
+			rec->name = r.str ();
+			if (!rec->name) {
+				free (data);
+				return false;
+			}
+		}
+	}
+
+	free (data);
+	return r.ok ();
+}
+
+uint32_t
+Lv2ScanCache::bundle_index (const char* path, bool create)
+{
+	char* p = normalize_path (path);
+	for (uint32_t i = 0; i < _n_bndl; ++i) {
+		if (!strcmp (_bndl[i].path, p)) {
+			free (p);
+			return i;
+		}
+	}
+	if (!create) {
+		free (p);
+		return UINT32_MAX;
+	}
+	_bndl = (Bundle*) realloc (_bndl, (_n_bndl + 1) * sizeof (Bundle));
+	_bndl[_n_bndl].path    = p;
+	_bndl[_n_bndl].key     = 0;
+	_bndl[_n_bndl].cur_key = 0;
+	_bndl[_n_bndl].checked = false;
+	return _n_bndl++;
+}
+
+bool
+Lv2ScanCache::bundle_ok (uint32_t idx)
+{
+	if (idx >= _n_bndl) {
+		return false;
+	}
+	Bundle* b = &_bndl[idx];
+	if (!b->checked) {
+		b->cur_key = bundle_key (b->path);
+		b->checked = true;
+	}
+	return b->key != 0 && b->key == b->cur_key;
+}
+
+static void scan_dir_entry (const char* dir, const char* name, void* data)
+{
+	if (!strcmp (name, ".") || !strcmp (name, "..")) {
+		return;
+	}
+	char b_path[1024];
+	snprintf (b_path, 1023, COMPOSE_FN, dir, name);
+	b_path[1023] = 0;
+
+	/* bundle_index() is private, collect paths */
+	char*** paths = (char***) data;
+	size_t n = 0;
+	while (*paths && (*paths)[n]) { ++n; }
+	*paths = (char**) realloc (*paths, (n + 2) * sizeof (char*));
+	(*paths)[n] = strdup (b_path);
+	(*paths)[n + 1] = NULL;
+}
+
+/* check all bundles, same lookup as lilv_world_load_all()
+ * or explicit bundles (see LV2Parser) */
+void
+Lv2ScanCache::scan_bundles ()
+{
+	if (_scanned) {
+		return;
+	}
+	_scanned = true;
+
+	char** paths = NULL;
+
+	if (_bundles && _bundles[0]) {
+		for (unsigned int i = 0; _bundles[i]; ++i) {
+			char b_path[1024];
+			snprintf (b_path, 1023, COMPOSE_FN, get_lib_path (), _bundles[i]);
+			b_path[1023] = 0;
+			size_t n = i;
+			paths = (char**) realloc (paths, (n + 2) * sizeof (char*));
+			paths[n] = strdup (b_path);
+			paths[n + 1] = NULL;
+		}
+	} else {
+		const char* lv2_path = getenv ("LV2_PATH");
+		if (!lv2_path) {
+			lv2_path = LILV_DEFAULT_LV2_PATH;
+		}
+		char* lp = strdup (lv2_path);
+		char* dir = lp;
+		while (dir) {
+			char* sep = strchr (dir, LILV_PATH_SEP[0]);
+			if (sep) {
+				*sep = 0;
+			}
+			char* path = lilv_expand (dir);
+			if (path) {
+				lilv_dir_for_each (path, &paths, scan_dir_entry);
+				free (path);
+			}
+			dir = sep ? sep + 1 : NULL;
+		}
+		free (lp);
+	}
+
+	for (unsigned int i = 0; paths && paths[i]; ++i) {
+		uint64_t key = bundle_key (paths[i]);
+		if (key != 0) {
+			uint32_t idx = bundle_index (paths[i], true);
+			_bndl[idx].cur_key = key;
+			_bndl[idx].checked = true;
+		}
+		free (paths[i]);
+	}
+	free (paths);
+
+	/* bundles that were not found, have been removed */
+	for (uint32_t i = 0; i < _n_bndl; ++i) {
+		if (!_bndl[i].checked) {
+			_bndl[i].cur_key = 0;
+			_bndl[i].checked = true;
+		}
+	}
+}
+
+bool
+Lv2ScanCache::is_current ()
+{
+	if (_n_bndl == 0) {
+		return false;
+	}
+	scan_bundles ();
+	for (uint32_t i = 0; i < _n_bndl; ++i) {
+		if (_bndl[i].key != _bndl[i].cur_key) {
+			return false;
+		}
+	}
+	return true;
+}
+
+Lv2ScanCache::Record const*
+Lv2ScanCache::find (uint32_t id)
+{
+	for (uint32_t i = 0; i < _n_records; ++i) {
+		if (_records[i].id == id) {
+			return bundle_ok (_records[i].bundle) ? &_records[i] : NULL;
+		}
+	}
+	return NULL;
+}
+
+Lv2ScanCache::Record const*
+Lv2ScanCache::find (const char* uri)
+{
+	for (uint32_t i = 0; i < _n_records; ++i) {
+		if (!strcmp (_records[i].uri, uri)) {
+			return bundle_ok (_records[i].bundle) ? &_records[i] : NULL;
+		}
+	}
+	return NULL;
+}
+
+RtkLv2Description*
+Lv2ScanCache::get_desc (uint32_t id)
+{
+	Record const* r = find (id);
+	if (!r || r->status != Valid) {
+		return NULL;
+	}
+	return dup_desc (r->desc);
+}
+
+void
+Lv2ScanCache::add (const char* uri, const char* bundle_path, enum Status status, RtkLv2Description const* desc)
+{
+	_new = (Record*) realloc (_new, (_n_new + 1) * sizeof (Record));
+	Record* r = &_new[_n_new++];
+	r->id     = uri_to_id (uri);
+	r->uri    = strdup (uri);
+	r->bundle = bundle_index (bundle_path, true);
+	r->status = (status == Valid && !desc) ? Invalid : status;
+	r->status = r->status == Listed ? Unchecked : r->status;
+	r->desc   = r->status == Valid ? dup_desc (desc) : NULL;
+	r->name   = NULL;
+}
+
+void
+Lv2ScanCache::add (const char* uri, const char* bundle_path, const char* name)
+{
+	_new = (Record*) realloc (_new, (_n_new + 1) * sizeof (Record));
+	Record* r = &_new[_n_new++];
+	r->id     = uri_to_id (uri);
+	r->uri    = strdup (uri);
+	r->bundle = bundle_index (bundle_path, true);
+	r->status = name ? Listed : Invalid;
+	r->desc   = NULL;
+	r->name   = name ? strdup (name) : NULL;
+}
+
+void
+Lv2ScanCache::add (Record const* rec)
+{
+	_new = (Record*) realloc (_new, (_n_new + 1) * sizeof (Record));
+	Record* r = &_new[_n_new++];
+	r->id     = rec->id;
+	r->uri    = strdup (rec->uri);
+	r->bundle = rec->bundle;
+	r->status = rec->status;
+	r->desc   = rec->desc ? dup_desc (rec->desc) : NULL;
+	r->name   = rec->name ? strdup (rec->name) : NULL;
+}
+
+bool
+Lv2ScanCache::save ()
+{
+	scan_bundles ();
+
+	char tmp[1024];
+	snprintf (tmp, 1023, "%s.%d", _cache_file, (int) getpid ());
+	tmp[1023] = 0;
+
+	FILE* f = fopen (tmp, "wb");
+	if (!f) {
+		return false;
+	}
+
+	CacheWriter w (f);
+	w.data (scan_cache_magic, sizeof (scan_cache_magic));
+	w.u32 (SCAN_CACHE_VERSION);
+
+	w.u32 (_n_bndl);
+	for (uint32_t i = 0; i < _n_bndl; ++i) {
+		w.str (_bndl[i].path);
+		w.u64 (_bndl[i].cur_key);
+	}
+
+	w.u32 (_n_new);
+	for (uint32_t i = 0; i < _n_new; ++i) {
+		Record const* r = &_new[i];
+		w.u32 (r->id);
+		w.str (r->uri);
+		w.u32 (r->bundle);
+		w.u32 (r->status);
+		if (r->status == Valid) {
+			write_desc (w, r->desc);
+		} else if (r->status == Listed) {
+			w.str (r->name);
+		}
+	}
+
+	if (fclose (f) || !w.ok ()) {
+		unlink (tmp);
+		return false;
+	}
+
+#ifdef _WIN32
+	unlink (_cache_file);
+#endif
+	if (rename (tmp, _cache_file)) {
+		unlink (tmp);
+		return false;
+	}
+	return true;
+}
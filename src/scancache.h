@@ -0,0 +1,104 @@
+/*
+ *  Copyright (C) 2016 Robin Gareus <robin@gareus.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef _scancache_h_
+#define _scancache_h_
+
+#include <stdint.h>
+#include "lv2desc.h"
+
+/* Persistent plugin-scan cache.
+ *
+ * Parsed plugin descriptions are stored in a binary file next to
+ * lv2vst.so (".scancache"). Every record is tied to the LV2 bundle that
+ * provides the plugin. A bundle is identified by its path and a key
+ * derived from name, mtime and size of all .ttl files in the bundle.
+ * Records of bundles that changed since the cache was written are ignored.
+ */
+class Lv2ScanCache
+{
+	public:
+		enum Status {
+			Unchecked = 0, ///< plugin was indexed, but not validated (filtered)
+			Invalid,       ///< plugin is not supported by lv2vst
+			Valid,         ///< desc is available
+			Listed         ///< only manifest-level checks passed, name is available
+		};
+
+		struct Record {
+			uint32_t           id;
+			char*              uri;
+			uint32_t           bundle;
+			enum Status        status;
+			RtkLv2Description* desc;
+			char*              name;
+		};
+
+		Lv2ScanCache (char const* const* bundles);
+		~Lv2ScanCache ();
+
+		/* true if no bundle was added, removed or modified since
+		 * the cache was written. */
+		bool is_current ();
+
+		/* cached records, in the order they were written */
+		uint32_t n_records () const { return _n_records; }
+		Record const* record (uint32_t i) const { return &_records[i]; }
+
+		/* find record of an unchanged bundle, NULL if unknown or stale */
+		Record const* find (uint32_t id);
+		Record const* find (const char* uri);
+
+		/* copy of a cached description, NULL if it needs to be (re)parsed */
+		RtkLv2Description* get_desc (uint32_t id);
+
+		/* collect records for the next save() */
+		void add (const char* uri, const char* bundle_path, enum Status, RtkLv2Description const*);
+		void add (const char* uri, const char* bundle_path, const char* name); ///< Listed, or Invalid if name is NULL
+		void add (Record const*);
+		bool save ();
+
+	private:
+		struct Bundle {
+			char*    path;
+			uint64_t key;
+			uint64_t cur_key;
+			bool     checked;
+		};
+
+		bool load ();
+		void scan_bundles ();
+		uint32_t bundle_index (const char* path, bool create);
+		bool bundle_ok (uint32_t idx);
+
+		char* _cache_file;
+		char const* const* _bundles;
+
+		Bundle*  _bndl;
+		uint32_t _n_bndl;
+
+		Record*  _records;
+		uint32_t _n_records;
+
+		Record*  _new;
+		uint32_t _n_new;
+
+		bool _scanned;
+};
+
+#endif
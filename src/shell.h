@@ -20,14 +20,60 @@
 #define _vst_shell_h_
 
 #include "vst.h"
+
+#ifdef STATIC_DESC
+
+/* list descriptions generated at build-time,
+ * bundles and whitelist were already applied by lv2ttl2c */
+class LV2ShellPlugin : public VstPlugin
+{
+	public:
+		LV2ShellPlugin (audioMasterCallback audioMaster, char** bundles, char** wl, char** bl)
+			: VstPlugin (audioMaster, 0)
+			, _iter (0)
+		{
+			free_lines (bundles);
+			free_lines (wl);
+			free_lines (bl);
+		}
+
+		int32_t shell_get_next_plugin (char* name) {
+			RtkLv2Description const* d = static_desc (_iter);
+			if (!d) {
+				return 0;
+			}
+			++_iter;
+			strncpy (name, d->plugin_name, 64);
+			name[64] = 0;
+			return d->id;
+		}
+
+		VstPlugCategory get_category () {
+			return kPlugCategShell;
+		}
+
+		void process (float**, float**, int32_t) {}
+
+	private:
+		uint32_t _iter;
+};
+
+#else
+
 #include "lilv/lilv.h"
+#include "scancache.h"
 
 class LV2ShellPlugin : public VstPlugin
 {
 	public:
 		LV2ShellPlugin (audioMasterCallback audioMaster, char** bundles, char** wl, char** bl)
 			: VstPlugin (audioMaster, 0)
-			, world (lilv_world_new ())
+			, world (0)
+			, _cache (bundles)
+			, _cache_dirty (false)
+			, _plugins (0)
+			, _n_plugins (0)
+			, _iter (0)
 			, _bundles (bundles)
 			, _whitelist (wl)
 			, _blacklist (bl)
@@ -39,16 +85,71 @@ class LV2ShellPlugin : public VstPlugin
 			dump_lines ("BL: ", _blacklist);
 #endif
 
+			if (_cache.is_current ()) {
+				/* no bundle changed since the last scan */
+				index_cache ();
+			} else {
+				index_world ();
+			}
+
+			if (_cache_dirty) {
+				_cache.save ();
+			}
+
+			/* the list is complete, the world is no longer needed */
+			lilv_world_free (world);
+			world = 0;
+		}
+
+		int32_t shell_get_next_plugin (char* name) {
+			if (_iter >= _n_plugins) {
+				return 0;
+			}
+			ShellEntry const* e = &_plugins[_iter++];
+			strncpy (name, e->name, 64);
+			name[64] = 0;
+#ifndef NDEBUG
+			printf ("ID %08x -- %s\n", e->id, name);
+#endif
+			return e->id;
+		}
+
+		~LV2ShellPlugin () {
+			lilv_world_free (world);
+			free (_plugins);
+			free_lines (_bundles);
+			free_lines (_blacklist);
+			free_lines (_whitelist);
+		}
+
+		VstPlugCategory get_category () {
+			return kPlugCategShell;
+		}
+
+		void process (float**, float**, int32_t) {}
+
+	private:
+		struct ShellEntry {
+			uint32_t id;
+			char     name[65];
+		};
+
+		void load_world () {
+			if (world) {
+				return;
+			}
+			world = lilv_world_new ();
+
 			// code-dup src/lv2ttl.cc
 			unsigned int bndl_it = 0;
-			if (bundles) {
-				while (bundles[bndl_it]) {
+			if (_bundles) {
+				while (_bundles[bndl_it]) {
 
 					char b_path[1024];
 #ifdef PLATFORM_WINDOWS
-					snprintf (b_path, 1023, "%s\\%s\\", get_lib_path (), bundles[bndl_it]);
+					snprintf (b_path, 1023, "%s\\%s\\", get_lib_path (), _bundles[bndl_it]);
 #else
-					snprintf (b_path, 1023, "%s/%s/", get_lib_path (), bundles[bndl_it]);
+					snprintf (b_path, 1023, "%s/%s/", get_lib_path (), _bundles[bndl_it]);
 #endif
 					b_path[1023] = 0;
 					++bndl_it;
@@ -60,22 +161,144 @@ class LV2ShellPlugin : public VstPlugin
 			}
 
 			if (bndl_it == 0) {
+				LilvNode* parallel = lilv_new_bool (world, true);
+				lilv_world_set_option (world, LILV_OPTION_PARALLEL_LOAD, parallel);
+				lilv_node_free (parallel);
 				lilv_world_load_all (world);
 			}
 			// end code-dup
+		}
 
-			all_plugins = lilv_world_get_all_plugins (world);
-			iter = lilv_plugins_begin (all_plugins);
+		void add_plugin (uint32_t id, const char* name) {
+			_plugins = (ShellEntry*) realloc (_plugins, (_n_plugins + 1) * sizeof (ShellEntry));
+			_plugins[_n_plugins].id = id;
+			strncpy (_plugins[_n_plugins].name, name, 64);
+			_plugins[_n_plugins].name[64] = 0;
+			++_n_plugins;
 		}
 
-		int32_t shell_get_next_plugin (char* name) {
-			if (lilv_plugins_is_end (all_plugins, iter)) {
-				return 0;
+		/* test required features, using the shell's world */
+		RtkLv2Description* validate (const char* uri) {
+			load_world ();
+			return get_desc_from_world (world, uri);
+		}
+
+		/* true if the cached result can be used as-is */
+		static bool is_final (Lv2ScanCache::Record const* rec) {
+			switch (rec->status) {
+				case Lv2ScanCache::Valid:
+				case Lv2ScanCache::Invalid:
+					return true;
+#ifdef LIGHT_SCAN
+				case Lv2ScanCache::Listed:
+					return true;
+#endif
+				default:
+					return false;
+			}
+		}
+
+		static const char* record_name (Lv2ScanCache::Record const* rec) {
+			return rec->status == Lv2ScanCache::Valid ? rec->desc->plugin_name : rec->name;
+		}
+
+		/* check an unfiltered plugin, add it to the list and the cache */
+		void check_plugin (const char* uri, const char* bundle) {
+#ifdef LIGHT_SCAN
+			/* name only, full description is parsed on instantiation */
+			load_world ();
+			char* name = get_name_from_world (world, uri);
+			_cache.add (uri, bundle, name);
+			if (name) {
+				add_plugin (uri_to_id (uri), name);
+			}
+			free (name);
+#else
+			RtkLv2Description* plugin = validate (uri);
+			_cache.add (uri, bundle, plugin ? Lv2ScanCache::Valid : Lv2ScanCache::Invalid, plugin);
+			if (plugin) {
+				/* bitwig-studio will ignore _ALL_ in the shell if only one fails.
+				 * all hail Ardour & Reaper. */
+				add_plugin (plugin->id, plugin->plugin_name);
+				free_desc (plugin);
 			}
+#endif
+		}
 
-			const LilvPlugin* p = lilv_plugins_get (all_plugins, iter);
-			const char* uri = lilv_node_as_uri (lilv_plugin_get_uri (p));
+		/* list plugins from the scan-cache */
+		void index_cache () {
+			for (uint32_t i = 0; i < _cache.n_records (); ++i) {
+				Lv2ScanCache::Record const* rec = _cache.record (i);
+				if (!filter (rec->uri) || rec->status == Lv2ScanCache::Invalid) {
+					_cache.add (rec);
+					continue;
+				}
+				if (is_final (rec)) {
+					_cache.add (rec);
+					add_plugin (rec->id, record_name (rec));
+					continue;
+				}
 
+				/* previously filtered, validate now. The bundle is unchanged. */
+				_cache_dirty = true;
+#ifdef LIGHT_SCAN
+				load_world ();
+				Lv2ScanCache::Record r = *rec;
+				r.name = get_name_from_world (world, rec->uri);
+				r.status = r.name ? Lv2ScanCache::Listed : Lv2ScanCache::Invalid;
+				r.desc = NULL;
+				_cache.add (&r);
+				if (r.name) {
+					add_plugin (rec->id, r.name);
+				}
+				free (r.name);
+#else
+				RtkLv2Description* plugin = validate (rec->uri);
+				Lv2ScanCache::Record r = *rec;
+				r.status = plugin ? Lv2ScanCache::Valid : Lv2ScanCache::Invalid;
+				r.desc = plugin;
+				r.name = NULL;
+				_cache.add (&r);
+				if (plugin) {
+					add_plugin (rec->id, plugin->plugin_name);
+					free_desc (plugin);
+				}
+#endif
+			}
+		}
+
+		/* index all plugins of the world, re-use cached results of unmodified bundles */
+		void index_world () {
+			load_world ();
+			_cache_dirty = true;
+
+			const LilvPlugins* all_plugins = lilv_world_get_all_plugins (world);
+			LILV_FOREACH(plugins, i, all_plugins) {
+				const LilvPlugin* p = lilv_plugins_get (all_plugins, i);
+				const char* uri = lilv_node_as_uri (lilv_plugin_get_uri (p));
+				Lv2ScanCache::Record const* rec = _cache.find (uri);
+
+				if (rec && (is_final (rec) || !filter (uri))) {
+					/* bundle is unchanged, use cached result */
+					_cache.add (rec);
+					if (rec->status != Lv2ScanCache::Invalid && is_final (rec) && filter (uri)) {
+						add_plugin (rec->id, record_name (rec));
+					}
+					continue;
+				}
+
+				char* bundle = lilv_file_uri_parse (lilv_node_as_uri (lilv_plugin_get_bundle_uri (p)), NULL);
+
+				if (!filter (uri)) {
+					_cache.add (uri, bundle, Lv2ScanCache::Unchecked, NULL);
+				} else {
+					check_plugin (uri, bundle);
+				}
+				lilv_free (bundle);
+			}
+		}
+
+		bool filter (const char* uri) const {
 			bool ok = false;
 			if (!_whitelist || _whitelist[0] == NULL) {
 				ok = true;
@@ -101,70 +324,21 @@ class LV2ShellPlugin : public VstPlugin
 				}
 			}
 
-			if (!ok) {
-				iter = lilv_plugins_next (all_plugins, iter);
-				return shell_get_next_plugin (name);
-			}
-
-			uint32_t id = uri_to_id (uri);
-
-#if 1 // test required features
-			RtkLv2Description* plugin = get_desc_by_id (id, _bundles);
-			if (!plugin) {
-				iter = lilv_plugins_next (all_plugins, iter);
-				return shell_get_next_plugin (name);
-			}
-
-# if 0 // try instantiate -- don't return NULL for a sub-plugin later.
-
-			/* bitwig-studio will ignore _ALL_ in the shell if only one fails.
-			 * all hail Ardour & Reaper. */
-
-			LV2Vst* test;
-			try {
-				test = new LV2Vst (audioMaster, plugin);
-			} catch (...) {
-				fprintf (stderr, "CRASH %08x\n", id);
-				free_desc (plugin);
-				iter = lilv_plugins_next (all_plugins, iter);
-				return shell_get_next_plugin (name);
-			}
-			delete test;
-# endif
-			free_desc (plugin);
-#endif
-
-			LilvNode* n = lilv_plugin_get_name (p);
-			strncpy (name, lilv_node_as_string (n), 64);
-			name[64] = 0;
-#ifndef NDEBUG
-			printf ("ID %08x -- %s\n", id, name);
-#endif
-			lilv_node_free (n);
-			iter = lilv_plugins_next (all_plugins, iter);
-			return id;
-		}
-
-		~LV2ShellPlugin () {
-			lilv_world_free (world);
-			free_lines (_bundles);
-			free_lines (_blacklist);
-			free_lines (_whitelist);
+			return ok;
 		}
 
-		VstPlugCategory get_category () {
-			return kPlugCategShell;
-		}
+		LilvWorld* world;
 
-		void process (float**, float**, int32_t) {}
+		Lv2ScanCache _cache;
+		bool         _cache_dirty;
 
-	private:
-		LilvWorld* world;
-		const LilvPlugins* all_plugins;
-		LilvIter* iter;
+		ShellEntry* _plugins;
+		uint32_t    _n_plugins;
+		uint32_t    _iter;
 
 		char** _bundles;
 		char** _whitelist;
 		char** _blacklist;
 };
+#endif // STATIC_DESC
 #endif
@@ -213,7 +213,11 @@ int32_t LV2Vst::get_chunk (void** data, bool /*is_preset*/)
 			continue;
 		}
 		state->values = (LV2PortValue*) realloc (state->values, (state->n_values + 1) * sizeof (LV2PortValue));
+#ifdef PIPELINE
+		state->values[state->n_values].value = _ctrl_in.value (p);
+#else
 		state->values[state->n_values].value = _ports[p];
+#endif
 		state->values[state->n_values].symbol = strdup (_desc->ports[p].symbol);
 		++state->n_values;
 	}
@@ -257,16 +261,20 @@ int32_t LV2Vst::set_chunk (void* data, int32_t size, bool /*is_preset*/)
 			if (strcmp (_desc->ports[p].symbol, pv->symbol)) {
 				continue;
 			}
+#ifdef PIPELINE
+			if (_ctrl_in.value (p) == pv->value) {
+				continue;
+			}
+			_ctrl_in.set (p, pv->value);
+#else
 			if (_ports[p] == pv->value) {
 				continue;
 			}
 
 			_ports[p] = pv->value;
+#endif
 			if (_ui.is_open ()) {
-				if (ctrl_to_ui.write_space () > 0) {
-					ParamVal pv (p, _ports[p]);
-					ctrl_to_ui.write (&pv, 1);
-				}
+				ctrl_to_ui.set (p, pv->value);
 			}
 			set_parameter_automated (portmap_ctrl (p), param_to_vst(p, pv->value)); // Tell host about it
 		}
@@ -278,7 +286,15 @@ int32_t LV2Vst::set_chunk (void* data, int32_t size, bool /*is_preset*/)
 	}
 	if (iface && iface->restore) {
 		iface->restore (_plugin_instance, retrieve_callback, (LV2_State_Handle)state, 0, NULL);
+#ifdef MULTI_MONO
+		for (uint32_t k = 1; k < _n_mono; ++k) {
+			iface->restore (instance (k), retrieve_callback, (LV2_State_Handle)state, 0, NULL);
+		}
+#endif
 	}
+#ifdef IDLE_SKIP
+	__atomic_store_n (&_idle_wakeup, true, __ATOMIC_RELEASE);
+#endif
 
 	free_lv2state (state);
 	return 0;
@@ -19,13 +19,62 @@
 #ifndef _uri_map_h
 #define _uri_map_h
 
+#include <assert.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lv2/lv2plug.in/ns/ext/uri-map/uri-map.h"
 #include "lv2/lv2plug.in/ns/ext/urid/urid.h"
 
+/* URI <> URID map, safe to use concurrently from any thread.
+ *
+ * Lookups of known URIs are wait-free: an open-addressing hash-table
+ * (load factor <= 1/2) is probed without locking. New URIs are added
+ * under a mutex. IDs are never removed, entries are never moved and
+ * the table is only replaced (grown) as a whole, so a concurrent reader
+ * either sees the old or the new table. Previous tables are kept until
+ * the map is destroyed.
+ *
+ * id_to_uri() uses an append-only segmented array (segment k holds
+ * 64 << k entries) and is also wait-free.
+ */
 class Lv2UriMap
 {
 	public:
-		Lv2UriMap () : urimap (NULL) , urimap_len (0) {}
-		~Lv2UriMap () { free_uri_map (); }
+		Lv2UriMap ()
+			: _table (NULL)
+			, _n_ids (0)
+		{
+			memset (_seg, 0, sizeof (_seg));
+			pthread_mutex_init (&_lock, NULL);
+			_table = alloc_table (256, NULL);
+		}
+
+		~Lv2UriMap () {
+			for (uint32_t i = 0; i < _n_ids; ++i) {
+				free (id_entry (i + 1));
+			}
+			for (uint32_t k = 0; k < N_SEGMENTS; ++k) {
+				free (_seg[k]);
+			}
+			while (_table) {
+				Table* t = _table;
+				_table = t->prev;
+				free (t);
+			}
+			pthread_mutex_destroy (&_lock);
+		}
+
+#ifdef SHARED_URID_MAP
+		/* process-wide map, shared by all plugin instances */
+		static Lv2UriMap& shared () {
+			static Lv2UriMap map;
+			return map;
+		}
+#endif
 
 		static LV2_URID uri_to_id (LV2_URI_Map_Callback_Data callback_data, const char* uri) {
 			Lv2UriMap* self = (Lv2UriMap*) callback_data;
@@ -38,39 +87,153 @@ class Lv2UriMap
 		}
 
 		LV2_URID uri_to_id (const char* uri) {
-			for (uint32_t i = 0; i < urimap_len; ++i) {
-				if (!strcmp (urimap[i], uri)) {
-					//printf("Found mapped URI '%s' -> %d\n", uri, i + 1);
-					return i + 1;
-				}
+			const uint32_t hash = hash_uri (uri);
+			LV2_URID id = lookup (uri, hash);
+			if (id) {
+				return id;
+			}
+			pthread_mutex_lock (&_lock);
+			id = lookup (uri, hash); // re-check, another thread may have added it
+			if (!id) {
+				id = insert (uri, hash);
 			}
-			//printf("map URI '%s' -> %d\n", uri, urimap_len + 1);
-			urimap = (char**) realloc (urimap, (urimap_len + 1) * sizeof (char*));
-			urimap[urimap_len] = strdup (uri);
-			return ++urimap_len;
+			pthread_mutex_unlock (&_lock);
+			return id;
 		}
 
-		const char* id_to_uri (LV2_URID i) {
-			assert (i > 0 && i <= urimap_len);
-			if (i == 0 || i > urimap_len) {
+		const char* id_to_uri (LV2_URID i) const {
+			assert (i > 0 && i <= load (_n_ids));
+			if (i == 0 || i > load (_n_ids)) {
 				fprintf (stderr, "LV2Host: invalid URID lookup\n");
 				return NULL;
 			}
-			//printf("lookup URI %d -> '%s'\n", i, urimap[i - 1]);
-			return urimap[i - 1];
+			return id_entry (i)->uri;
 		}
 
 	private:
-		void free_uri_map () {
-			for (uint32_t i = 0; i < urimap_len; ++i) {
-				free (urimap[i]);
+		struct Entry {
+			uint32_t hash;
+			LV2_URID id;
+			char     uri[1];
+		};
+
+		struct Table {
+			uint32_t mask;
+			Table*   prev;
+			Entry*   slot[1];
+		};
+
+		static const uint32_t SEGMENT_SHIFT = 6;
+		static const uint32_t N_SEGMENTS    = 26;
+
+		template <typename T> static T load (T const& p) {
+			return __atomic_load_n (&p, __ATOMIC_ACQUIRE);
+		}
+
+		template <typename T> static void store (T& p, T v) {
+			__atomic_store_n (&p, v, __ATOMIC_RELEASE);
+		}
+
+		/* FNV-1a */
+		static uint32_t hash_uri (const char* uri) {
+			uint32_t h = 2166136261U;
+			for (; *uri; ++uri) {
+				h = (h ^ (uint8_t)*uri) * 16777619U;
+			}
+			return h;
+		}
+
+		static Table* alloc_table (uint32_t size, Table* prev) {
+			Table* t = (Table*) calloc (1, sizeof (Table) + (size - 1) * sizeof (Entry*));
+			t->mask = size - 1;
+			t->prev = prev;
+			return t;
+		}
+
+		/* segment and offset of the given (1-based) ID */
+		static uint32_t id_segment (LV2_URID id, uint32_t* off) {
+			const uint32_t i = id - 1;
+			uint32_t k = 0;
+			while (((i >> SEGMENT_SHIFT) + 1) >> (k + 1)) {
+				++k;
+			}
+			*off = i - (((1U << k) - 1) << SEGMENT_SHIFT);
+			return k;
+		}
+
+		Entry* id_entry (LV2_URID id) const {
+			uint32_t off;
+			const uint32_t k = id_segment (id, &off);
+			return load (load (_seg[k])[off]);
+		}
+
+		LV2_URID lookup (const char* uri, uint32_t hash) const {
+			Table const* t = load (_table);
+			uint32_t i = hash & t->mask;
+			for (uint32_t n = 0; n <= t->mask; ++n, i = (i + 1) & t->mask) {
+				Entry const* e = load (t->slot[i]);
+				if (!e) {
+					break;
+				}
+				if (e->hash == hash && !strcmp (e->uri, uri)) {
+					return e->id;
+				}
+			}
+			return 0;
+		}
+
+		static void place (Table* t, Entry* e) {
+			uint32_t i = e->hash & t->mask;
+			while (t->slot[i]) {
+				i = (i + 1) & t->mask;
+			}
+			store (t->slot[i], e);
+		}
+
+		/* called with _lock held */
+		LV2_URID insert (const char* uri, uint32_t hash) {
+			const LV2_URID id = _n_ids + 1;
+
+			uint32_t off;
+			const uint32_t k = id_segment (id, &off);
+			if (k >= N_SEGMENTS) {
+				fprintf (stderr, "LV2Host: URID map is full\n");
+				return 0;
+			}
+
+			const size_t len = strlen (uri);
+			Entry* e = (Entry*) malloc (sizeof (Entry) + len);
+			e->hash = hash;
+			e->id   = id;
+			memcpy (e->uri, uri, len + 1);
+
+			/* publish id -> uri first, readers that find the
+			 * entry in the hash-table may look it up right away. */
+			if (!_seg[k]) {
+				store (_seg[k], (Entry**) calloc (1U << (k + SEGMENT_SHIFT), sizeof (Entry*)));
+			}
+			store (_seg[k][off], e);
+			store (_n_ids, id);
+
+			Table* t = _table;
+			if (2 * id > t->mask + 1) {
+				Table* nt = alloc_table (2 * (t->mask + 1), t);
+				for (uint32_t i = 0; i <= t->mask; ++i) {
+					if (t->slot[i]) {
+						place (nt, t->slot[i]);
+					}
+				}
+				place (nt, e);
+				store (_table, nt);
+			} else {
+				place (t, e);
 			}
-			free (urimap);
-			urimap = NULL;
-			urimap_len = 0;
+			return id;
 		}
 
-		char **urimap;
-		uint32_t urimap_len;
+		Table*          _table;
+		Entry**         _seg[N_SEGMENTS];
+		uint32_t        _n_ids;
+		pthread_mutex_t _lock;
 };
 #endif
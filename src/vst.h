@@ -245,6 +245,11 @@ class VstPlugin
 			return (VstTimeInfo*) (ret);
 		}
 
+		virtual int32_t get_process_level ()
+		{
+			return (int32_t) audioMaster (&_effect, audioMasterGetCurrentProcessLevel, 0, 0, 0, 0);
+		}
+
 		bool send_events_to_host (VstEvents* events)
 		{
 			return audioMaster (&_effect, audioMasterProcessEvents, 0, 0, events, 0) == 1;
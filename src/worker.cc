@@ -16,20 +16,89 @@
  *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
  */
 
+#include <assert.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
 #include "worker.h"
 
 #ifdef _WIN32
 #include <windows.h>
+#else
+#include <time.h>
+#endif
+
+#ifndef WORKER_THREADS
+# define WORKER_THREADS 0 // number of worker threads, 0: one per CPU core
 #endif
 
-static void* worker_func (void* data)
+#ifndef WORKER_BUFFER_SIZE
+# define WORKER_BUFFER_SIZE 8192 // min. size of request/response ringbuffers
+#endif
+
+static size_t ring_size (size_t max_msg_size)
 {
-	Lv2Worker* self =  (Lv2Worker*)data;
-	self->run ();
-	return NULL;
+	size_t s = 2 * (max_msg_size + 16);
+	return s > WORKER_BUFFER_SIZE ? s : WORKER_BUFFER_SIZE;
 }
 
+static void idle_wait ()
+{
+#ifdef _WIN32
+	Sleep (1);
+#else
+	usleep (1000);
+#endif
+}
+
+static uint32_t n_cpu_cores ()
+{
+#ifdef _WIN32
+	SYSTEM_INFO si;
+	GetSystemInfo (&si);
+	long n = si.dwNumberOfProcessors;
+#else
+	long n = sysconf (_SC_NPROCESSORS_ONLN);
+#endif
+	return n > 0 ? n : 1;
+}
+
+#ifdef WORKER_STATS
+/* monotonic time in usec, wraps around after ~71 min */
+static uint32_t now_us ()
+{
+#ifdef _WIN32
+	LARGE_INTEGER freq, cnt;
+	QueryPerformanceFrequency (&freq);
+	QueryPerformanceCounter (&cnt);
+	return (uint32_t) (cnt.QuadPart * 1000000 / freq.QuadPart);
+#else
+	struct timespec ts;
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+	return (uint32_t) (ts.tv_sec * 1000000 + ts.tv_nsec / 1000);
+#endif
+}
+
+void Lv2Worker::Stats::add (uint32_t stamp)
+{
+	const uint32_t dt = now_us () - stamp;
+	++count;
+	sum_us += dt;
+	if (dt > max_us) {
+		max_us = dt;
+	}
+}
+
+void Lv2Worker::Stats::print (const char* what) const
+{
+	if (count == 0) {
+		return;
+	}
+	fprintf (stderr, "LV2Host: worker %s latency: %u messages, avg %.1f us, max %u us\n",
+			what, count, sum_us / (double)count, max_us);
+}
+#endif
+
 static LV2_Worker_Status lv2_worker_respond (
 		LV2_Worker_Respond_Handle handle,
 		uint32_t                  size,
@@ -39,102 +108,246 @@ static LV2_Worker_Status lv2_worker_respond (
 	return self->respond (size, data);
 }
 
-Lv2Worker::Lv2Worker (const LV2_Worker_Interface* iface, LV2_Handle handle)
-	: _requests (4096)
-	, _responses (4096)
+/* ****************************************************************************
+ * Per instance worker
+ */
+
+/* ring-buffers are sized to hold messages of at least `max_msg_size` bytes */
+Lv2Worker::Lv2Worker (const LV2_Worker_Interface* iface, LV2_Handle handle, size_t max_msg_size)
+	: _requests (ring_size (max_msg_size))
+	, _responses (ring_size (max_msg_size))
 	, _iface (iface)
 	, _handle (handle)
-	, _run (false)
+	, _next (0)
+	, _queued (0)
+	, _active (0)
 	, _freewheeling (false)
 {
-	pthread_mutex_init (&_lock, NULL);
-	pthread_cond_init (&_ready, NULL);
-	pthread_create (&_thread, NULL, worker_func, this);
-	while (!_run) {
-#ifdef __APPLE__
-		sched_yield ();
-#elif defined _WIN32
-		Sleep (1);
-#else
-		pthread_yield ();
-#endif
-	}
+	_pool = Lv2WorkerPool::acquire ();
 }
 
 Lv2Worker::~Lv2Worker ()
 {
-	pthread_mutex_lock (&_lock);
-	_run = false;
-	pthread_cond_signal (&_ready);
-	pthread_mutex_unlock (&_lock);
-
-	pthread_join (_thread, NULL);
-	pthread_mutex_destroy (&_lock);
-	pthread_cond_destroy (&_ready);
+	/* wait for pending requests to be processed */
+	while (__atomic_load_n (&_queued, __ATOMIC_ACQUIRE) || __atomic_load_n (&_active, __ATOMIC_ACQUIRE)) {
+		idle_wait ();
+	}
+	Lv2WorkerPool::release ();
+#ifdef WORKER_STATS
+	_stats_work.print ("schedule-to-work");
+	_stats_response.print ("work-to-response");
+#endif
 }
 
 LV2_Worker_Status Lv2Worker::schedule (uint32_t size, const void* data)
 {
-	if (_freewheeling) {
+	/* run synchronously, unless earlier requests are still being processed.
+	 * A pool thread may briefly reset _queued before it re-claims a late
+	 * request, all requests must have been released as well */
+	if (is_freewheeling () && !__atomic_load_n (&_queued, __ATOMIC_ACQUIRE) && _requests.read_space () == 0) {
 		_iface->work (_handle, lv2_worker_respond, this, size, data);
 		return LV2_WORKER_SUCCESS;
 	}
-	_requests.write ((const char*)&size, sizeof (size));
-	_requests.write ((const char*)data, size);
-	if (pthread_mutex_trylock (&_lock) == 0) {
-		pthread_cond_signal (&_ready);
-		pthread_mutex_unlock (&_lock);
+#ifdef WORKER_STATS
+	if (!_requests.write_message (data, size, now_us ())) {
+#else
+	if (!_requests.write_message (data, size)) {
+#endif
+		return LV2_WORKER_ERR_NO_SPACE;
+	}
+
+	uint32_t idle = 0;
+	if (__atomic_compare_exchange_n (&_queued, &idle, 1, false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+		_pool->enqueue (this);
 	}
 	return LV2_WORKER_SUCCESS;
 }
 
 LV2_Worker_Status Lv2Worker::respond (uint32_t size, const void* data)
 {
-	if (_responses.write_space () >= sizeof (size) + size) {
-		_responses.write ((const char*)&size, sizeof (size));
-		_responses.write ((const char*)data, size);
+#ifdef WORKER_STATS
+	if (!_responses.write_message (data, size, now_us ())) {
+#else
+	if (!_responses.write_message (data, size)) {
+#endif
+		return LV2_WORKER_ERR_NO_SPACE;
 	}
 	return LV2_WORKER_SUCCESS;
 }
 
 void Lv2Worker::emit_response ()
 {
-	uint32_t read_space = _responses.read_space ();
-	while (read_space) {
-		uint32_t size = 0;
-		char worker_response[4096];
-		_responses.read ((char*)&size, sizeof (size));
-		_responses.read (worker_response, size);
-		_iface->work_response (_handle, size, worker_response);
-		read_space -= sizeof (size) + size;
+	uint32_t size;
+	uint32_t stamp;
+	const void* data;
+	while ((data = _responses.peek_message (&size, &stamp))) {
+#ifdef WORKER_STATS
+		_stats_response.add (stamp);
+#endif
+		_iface->work_response (_handle, size, data);
+		_responses.release_message ();
 	}
 }
 
-void Lv2Worker::run ()
+/* called by a pool thread. Requests are never consumed concurrently for the
+ * same instance, a second thread may only start after _queued was reset */
+void Lv2Worker::process_requests ()
 {
-	pthread_mutex_lock (&_lock);
-	_run = true;
 	while (1) {
-		char buf[4096];
-		uint32_t size = 0;
-
-		if (_requests.read_space () <= sizeof (size)) {
-			pthread_cond_wait (&_ready, &_lock);
+		uint32_t size;
+		uint32_t stamp;
+		const void* data;
+		while ((data = _requests.peek_message (&size, &stamp))) {
+#ifdef WORKER_STATS
+			_stats_work.add (stamp);
+#endif
+			_iface->work (_handle, lv2_worker_respond, this, size, data);
+			_requests.release_message ();
 		}
 
-		if (!_run) {
+		__atomic_store_n (&_queued, 0, __ATOMIC_SEQ_CST);
+		__atomic_thread_fence (__ATOMIC_SEQ_CST);
+
+		/* a request may have arrived after the queue was drained,
+		 * while _queued was still set. re-claim it, unless schedule ()
+		 * has already re-queued this instance. */
+		if (_requests.read_space () == 0) {
+			break;
+		}
+		uint32_t idle = 0;
+		if (!__atomic_compare_exchange_n (&_queued, &idle, 1, false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
 			break;
 		}
+	}
+}
+
+/* ****************************************************************************
+ * Worker thread pool
+ */
+
+Lv2WorkerPool*  Lv2WorkerPool::_instance = NULL;
+uint32_t        Lv2WorkerPool::_refcnt = 0;
+pthread_mutex_t Lv2WorkerPool::_instance_lock = PTHREAD_MUTEX_INITIALIZER;
+
+Lv2WorkerPool* Lv2WorkerPool::acquire ()
+{
+	pthread_mutex_lock (&_instance_lock);
+	if (_refcnt++ == 0) {
+		uint32_t n_threads = WORKER_THREADS;
+		if (n_threads == 0) {
+			n_threads = n_cpu_cores ();
+		}
+		_instance = new Lv2WorkerPool (n_threads);
+	}
+	Lv2WorkerPool* pool = _instance;
+	pthread_mutex_unlock (&_instance_lock);
+	return pool;
+}
+
+void Lv2WorkerPool::release ()
+{
+	pthread_mutex_lock (&_instance_lock);
+	assert (_refcnt > 0);
+	if (--_refcnt == 0) {
+		delete _instance;
+		_instance = NULL;
+	}
+	pthread_mutex_unlock (&_instance_lock);
+}
+
+Lv2WorkerPool::Lv2WorkerPool (uint32_t n_threads)
+	: _n_threads (0)
+	, _pending (0)
+	, _fifo (0)
+	, _run (true)
+{
+	pthread_mutex_init (&_lock, NULL);
+
+	_threads = (pthread_t*) malloc (n_threads * sizeof (pthread_t));
+	for (uint32_t i = 0; i < n_threads; ++i) {
+		if (pthread_create (&_threads[_n_threads], NULL, thread_func, this) == 0) {
+			++_n_threads;
+		}
+	}
+	if (_n_threads == 0) {
+		fprintf (stderr, "LV2Host: failed to create worker thread(s).\n");
+	}
+}
 
-		_requests.read ((char*)&size, sizeof (size));
+Lv2WorkerPool::~Lv2WorkerPool ()
+{
+	__atomic_store_n (&_run, false, __ATOMIC_RELEASE);
+	for (uint32_t i = 0; i < _n_threads; ++i) {
+		_sem.signal ();
+	}
+	for (uint32_t i = 0; i < _n_threads; ++i) {
+		pthread_join (_threads[i], NULL);
+	}
+	free (_threads);
+	pthread_mutex_destroy (&_lock);
+}
+
+void* Lv2WorkerPool::thread_func (void* data)
+{
+	Lv2WorkerPool* self = (Lv2WorkerPool*)data;
+	self->run ();
+	return NULL;
+}
+
+/* called from the realtime thread: push to a lock-free stack,
+ * and wake up one thread. Neither blocks. */
+void Lv2WorkerPool::enqueue (Lv2Worker* w)
+{
+	Lv2Worker* head = __atomic_load_n (&_pending, __ATOMIC_RELAXED);
+	do {
+		w->_next = head;
+	} while (!__atomic_compare_exchange_n (&_pending, &head, w, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+
+	_sem.signal ();
+}
+
+/* called with _lock held */
+Lv2Worker* Lv2WorkerPool::dequeue ()
+{
+	if (!_fifo) {
+		/* take all pending, reverse into FIFO order */
+		Lv2Worker* w = __atomic_exchange_n (&_pending, (Lv2Worker*)0, __ATOMIC_ACQUIRE);
+		while (w) {
+			Lv2Worker* next = w->_next;
+			w->_next = _fifo;
+			_fifo = w;
+			w = next;
+		}
+	}
+	Lv2Worker* w = _fifo;
+	if (w) {
+		_fifo = w->_next;
+		__atomic_fetch_add (&w->_active, 1, __ATOMIC_ACQ_REL);
+	}
+	return w;
+}
 
-		if (size > 4096) {
-			fprintf (stderr, "LV2Host: Worker information is too large. Abort.\n");
+/* every enqueue () posts the semaphore once, so each wakeup
+ * corresponds to one queued instance. */
+void Lv2WorkerPool::run ()
+{
+	while (1) {
+		_sem.wait ();
+		if (!__atomic_load_n (&_run, __ATOMIC_ACQUIRE)) {
 			break;
 		}
 
-		_requests.read (buf, size);
-		_iface->work (_handle, lv2_worker_respond, this, size, buf);
+		pthread_mutex_lock (&_lock);
+		Lv2Worker* w = dequeue ();
+		pthread_mutex_unlock (&_lock);
+
+		if (!w) {
+			continue;
+		}
+
+		w->process_requests ();
+		/* another thread may already process this instance, after it was
+		 * re-queued, while this one was checking for late requests */
+		__atomic_fetch_sub (&w->_active, 1, __ATOMIC_ACQ_REL);
 	}
-	pthread_mutex_unlock (&_lock);
 }
@@ -24,11 +24,21 @@
 #include "lv2/lv2plug.in/ns/ext/worker/worker.h"
 
 #include "ringbuffer.h"
+#include "rtsemaphore.h"
 
+class Lv2WorkerPool;
+
+/* per plugin-instance worker: request and response queues.
+ *
+ * Requests are processed by a process-wide pool of threads
+ * (Lv2WorkerPool). At most one pool-thread handles requests of
+ * a given instance at any time, so work() is never called concurrently
+ * for the same plugin instance.
+ */
 class Lv2Worker
 {
 	public:
-		Lv2Worker (const LV2_Worker_Interface* iface, LV2_Handle handle);
+		Lv2Worker (const LV2_Worker_Interface* iface, LV2_Handle handle, size_t max_msg_size);
 		~Lv2Worker ();
 
 		static LV2_Worker_Status lv2_worker_schedule (
@@ -43,8 +53,11 @@ class Lv2Worker
 		LV2_Worker_Status schedule (uint32_t size, const void* data);
 		LV2_Worker_Status respond (uint32_t size, const void* data);
 		void emit_response ();
-		void set_freewheeling (bool yn) { _freewheeling = yn; }
-		void run ();
+		void set_freewheeling (bool yn) { __atomic_store_n (&_freewheeling, yn, __ATOMIC_RELAXED); }
+		bool is_freewheeling () const { return __atomic_load_n (&_freewheeling, __ATOMIC_RELAXED); }
+		bool idle () const {
+			return !__atomic_load_n (&_queued, __ATOMIC_ACQUIRE) && _responses.read_space () == 0;
+		}
 		void end_run () {
 			if (_iface->end_run) {
 				_iface->end_run (_handle);
@@ -52,16 +65,67 @@ class Lv2Worker
 		}
 
 	private:
-		Lv2VstUtil::RingBuffer<char> _requests;
-		Lv2VstUtil::RingBuffer<char> _responses;
+		friend class Lv2WorkerPool;
+
+		void process_requests ();
+
+		Lv2VstUtil::MessageRing      _requests;
+		Lv2VstUtil::MessageRing      _responses;
 
 		const LV2_Worker_Interface*  _iface;
 		LV2_Handle                   _handle;
 
-		pthread_t                    _thread;
-		pthread_mutex_t              _lock;
-		pthread_cond_t               _ready;
-		volatile bool                _run;
+		Lv2WorkerPool*               _pool;
+		Lv2Worker*                   _next;   ///< pool queue link
+		uint32_t                     _queued; ///< 1: in pool queue or being processed
+		uint32_t                     _active; ///< number of pool threads using this instance
 		bool                         _freewheeling;
+
+#ifdef WORKER_STATS
+		/* latencies, each is only updated by a single thread */
+		struct Stats {
+			Stats () : count (0), max_us (0), sum_us (0) {}
+			void add (uint32_t stamp);
+			void print (const char* what) const;
+			uint32_t count;
+			uint32_t max_us;
+			uint64_t sum_us;
+		};
+		Stats _stats_work;     ///< schedule () until work () is called
+		Stats _stats_response; ///< respond () until work_response () is called
+#endif
 };
+
+/* process-wide worker threads, shared by all plugin instances */
+class Lv2WorkerPool
+{
+	public:
+		static Lv2WorkerPool* acquire ();
+		static void release ();
+
+		void enqueue (Lv2Worker*);
+
+	private:
+		Lv2WorkerPool (uint32_t n_threads);
+		~Lv2WorkerPool ();
+
+		static void* thread_func (void*);
+		void run ();
+		Lv2Worker* dequeue ();
+
+		pthread_t*      _threads;
+		uint32_t        _n_threads;
+
+		Lv2Worker*      _pending; ///< lock-free LIFO, pushed by schedule ()
+		Lv2Worker*      _fifo;    ///< FIFO, protected by _lock
+
+		pthread_mutex_t _lock; ///< serializes dequeue ()
+		Lv2VstUtil::Semaphore _sem;
+		bool            _run;
+
+		static Lv2WorkerPool*  _instance;
+		static uint32_t        _refcnt;
+		static pthread_mutex_t _instance_lock;
+};
+
 #endif